@@ -0,0 +1,79 @@
+/**
+ * CPU throughput benchmark
+ * Runs a synthetic 6502 workload from RAM and reports emulated MHz.
+ * Built once per dispatch engine (and with the block cache and JIT) by "make bench".
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+
+#include "machine.hpp"
+
+// Mix of loads, stores, ALU, read-modify-write, indirect and subroutine calls
+static const byte workload[] = {
+    0xa2, 0x00,             // 0800 LDX #$00
+    0xa0, 0x00,             // 0802 LDY #$00
+    0x98,                   // 0804 TYA
+    0x99, 0x00, 0x10,       // 0805 STA $1000,Y
+    0x5d, 0x00, 0x11,       // 0808 EOR $1100,X
+    0x65, 0x10,             // 080b ADC $10
+    0x85, 0x10,             // 080d STA $10
+    0x06, 0x11,             // 080f ASL $11
+    0x2a,                   // 0811 ROL A
+    0xb1, 0x20,             // 0812 LDA ($20),Y
+    0xc9, 0x80,             // 0814 CMP #$80
+    0x90, 0x02,             // 0816 BCC $081a
+    0xe6, 0x12,             // 0818 INC $12
+    0x20, 0x30, 0x08,       // 081a JSR $0830
+    0xc8,                   // 081d INY
+    0xd0, 0xe4,             // 081e BNE $0804
+    0xe8,                   // 0820 INX
+    0x4c, 0x04, 0x08,       // 0821 JMP $0804
+};
+
+static const byte subroutine[] = {
+    0xa5, 0x13,             // 0830 LDA $13
+    0x18,                   // 0832 CLC
+    0x69, 0x03,             // 0833 ADC #$03
+    0x85, 0x13,             // 0835 STA $13
+    0x60,                   // 0837 RTS
+};
+
+int main(int argc, char *argv[]) {
+
+    long cyclesToRun = (argc > 1) ? atol(argv[1]) : 200000000;
+
+    Machine* machine = new Machine(Machine::loadSystemRom(""));
+    Mem* mem = machine->mem;
+    CPU* cpu = machine->cpu;
+
+    machine->reset();
+
+    for(uint32 i = 0 ; i < sizeof(workload) ; i++)
+        mem->writeByte(0x0800 + i, workload[i]);
+
+    for(uint32 i = 0 ; i < sizeof(subroutine) ; i++)
+        mem->writeByte(0x0830 + i, subroutine[i]);
+
+    // ($20) points to $1200
+    mem->writeWord(0x20, 0x1200);
+
+    cpu->pc = 0x0800;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Run in frame-sized slices like the main loop
+    for(long done = 0 ; done < cyclesToRun ; done += 17050)
+        cpu->emulateCycles(17050);
+
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    std::cout << (CPU_JIT ? "jit" : CPU_BLOCK_CACHE ? "blocks" : CPU_THREADED_DISPATCH ? "threaded" : "switch") << " "
+              << std::fixed << std::setprecision(2) << (cyclesToRun / seconds / 1e6) << " MHz" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * 6-and-2 encoder and decoder benchmark
+ * Encodes and decodes random sectors with the scalar and vector kernels,
+ * checks they agree and reports MB/s of sector data.
+ * Built with SSE2 and with AVX2 by "make bench-gcr".
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "disk_images.hpp"
+
+static const int SECTORS = 560;
+
+typedef void (*Encoder)(const byte* data, byte* output);
+typedef bool (*Decoder)(const byte* input, byte* data);
+
+static double megabytes(int rounds) {
+    return (double)rounds * SECTORS * 256 / 1e6;
+}
+
+static double encodeRate(Encoder encode, const byte* data, byte* disk, int rounds) {
+    auto start = std::chrono::steady_clock::now();
+
+    for(int r = 0 ; r < rounds ; r++)
+        for(int s = 0 ; s < SECTORS ; s++)
+            encode(data + s * 256, disk + s * 343);
+
+    auto end = std::chrono::steady_clock::now();
+
+    return megabytes(rounds) / std::chrono::duration<double>(end - start).count();
+}
+
+static double decodeRate(Decoder decode, const byte* disk, byte* data, int rounds) {
+    auto start = std::chrono::steady_clock::now();
+
+    for(int r = 0 ; r < rounds ; r++)
+        for(int s = 0 ; s < SECTORS ; s++)
+            decode(disk + s * 343, data + s * 256);
+
+    auto end = std::chrono::steady_clock::now();
+
+    return megabytes(rounds) / std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char *argv[]) {
+
+    int rounds = (argc > 1) ? atoi(argv[1]) : 2000;
+
+    byte* data = new byte[SECTORS * 256];
+    byte* scalarDisk = new byte[SECTORS * 343];
+    byte* simdDisk = new byte[SECTORS * 343];
+    byte* scalarData = new byte[SECTORS * 256];
+    byte* simdData = new byte[SECTORS * 256];
+
+    srand(1);
+
+    for(int i = 0 ; i < SECTORS * 256 ; i++)
+        data[i] = rand();
+
+    // Both kernels must produce the same disk bytes and sectors
+    bool ok = true;
+
+    for(int s = 0 ; s < SECTORS ; s++) {
+        encode62Scalar(data + s * 256, scalarDisk + s * 343);
+        encode62Simd(data + s * 256, simdDisk + s * 343);
+
+        ok &= decode62Scalar(scalarDisk + s * 343, scalarData + s * 256);
+        ok &= decode62Simd(simdDisk + s * 343, simdData + s * 256);
+    }
+
+    ok &= memcmp(scalarDisk, simdDisk, SECTORS * 343) == 0;
+    ok &= memcmp(scalarData, data, SECTORS * 256) == 0;
+    ok &= memcmp(simdData, data, SECTORS * 256) == 0;
+
+    // A bad checksum and an invalid disk byte are both rejected
+    simdDisk[342] ^= 0x01;
+    ok &= !decode62Scalar(simdDisk, simdData) && !decode62Simd(simdDisk, simdData);
+    simdDisk[342] ^= 0x01;
+    simdDisk[100] = 0xaa;
+    ok &= !decode62Scalar(simdDisk, simdData) && !decode62Simd(simdDisk, simdData);
+
+    if(!ok) {
+        std::cout << "scalar and vector kernels disagree" << std::endl;
+        return 1;
+    }
+
+    double encodeScalar = encodeRate(encode62Scalar, data, scalarDisk, rounds);
+    double encodeSimd = encodeRate(encode62Simd, data, simdDisk, rounds);
+    double decodeScalar = decodeRate(decode62Scalar, scalarDisk, scalarData, rounds);
+    double decodeSimd = decodeRate(decode62Simd, simdDisk, simdData, rounds);
+
+    std::cout << std::fixed << std::setprecision(1)
+              << (DISK_SIMD_AVX2 ? "avx2" : DISK_SIMD_SSE2 ? "sse2" : "scalar") << std::endl
+              << "encode scalar " << encodeScalar << " MB/s, vector " << encodeSimd << " MB/s, "
+              << std::setprecision(2) << (encodeSimd / encodeScalar) << "x" << std::endl
+              << std::setprecision(1)
+              << "decode scalar " << decodeScalar << " MB/s, vector " << decodeSimd << " MB/s, "
+              << std::setprecision(2) << (decodeSimd / decodeScalar) << "x" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,287 @@
+/**
+ * Headless batch runner
+ * Runs independent emulator instances on a thread pool, without the SDL front-end,
+ * and prints one JSON line per run : final registers, memory hashes and screen text.
+ * Built by "make batch".
+ *
+ * apple2batch [-j threads] [-c cycles] [-r rom] [-F] [-C] [-f jobfile] [disk ...]
+ * -F runs the disk in fast mode
+ * -C also runs each disk in fast mode and checks that it ends with the same
+ *    memory and screen, the exit status is 1 if any run differs
+ * Job file lines : <disk image, or - for none> [cycles]
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "machine.hpp"
+#include "log.hpp"
+
+// About 5 seconds of emulated time
+static const uint64 DEFAULT_CYCLES = 5000000;
+
+struct Job {
+    std::string disk;
+    uint64 cycles;
+};
+
+// Start of each text screen row on page 1
+static const word textRows[24] = {
+    0x0400, 0x0480, 0x0500, 0x0580, 0x0600, 0x0680, 0x0700, 0x0780,
+    0x0428, 0x04a8, 0x0528, 0x05a8, 0x0628, 0x06a8, 0x0728, 0x07a8,
+    0x0450, 0x04d0, 0x0550, 0x05d0, 0x0650, 0x06d0, 0x0750, 0x07d0
+};
+
+// FNV-1a
+static uint32 hash(const byte* data, uint32 size) {
+    uint32 h = 2166136261u;
+
+    for(uint32 i = 0 ; i < size ; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+// Normal characters have bit 7 set, inverse and flashing ones are shown plain
+static char screenChar(byte c) {
+    if(c < 0x80)
+        c &= 0x3f;
+
+    c &= 0x7f;
+
+    if(c < 0x20)
+        c += 0x40;
+
+    return c;
+}
+
+// Displayed text page, 80 columns interleave auxiliary and main memory
+static std::string screenLine(Mem* mem, int row) {
+    word base = textRows[row] + ((mem->sw_page2 && !mem->sw_80store) ? 0x400 : 0);
+
+    std::string line;
+
+    for(int col = 0 ; col < 40 ; col++) {
+        if(mem->sw_80col)
+            line += screenChar(mem->auxData[base + col]);
+
+        line += screenChar(mem->data[base + col]);
+    }
+
+    return line;
+}
+
+static std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+
+    for(char c : s) {
+        if(c == '"' || c == '\\')
+            out += '\\';
+
+        out += c;
+    }
+
+    return out + "\"";
+}
+
+static std::string hex(uint32 value) {
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "\"%08x\"", value);
+    return buffer;
+}
+
+// Runs whose fast disk result differs, see -C
+static std::atomic<int> fastMismatches(0);
+
+// Run a disk again in fast mode, true if memory and screen end as in the given run
+static bool fastDiskMatches(const Rom* rom, const Job& job, Mem* normal) {
+
+    Machine* machine = new Machine(rom);
+    machine->disk->fastMode = true;
+    Mem* mem = machine->mem;
+
+    bool match = machine->loadDisk(job.disk, false) == 0;
+
+    if(match) {
+        machine->reset();
+        machine->cpu->emulateUntil(job.cycles);
+
+        match = hash(mem->data, Mem::MAX_SIZE) == hash(normal->data, Mem::MAX_SIZE) &&
+                hash(mem->auxData, Mem::MAX_SIZE) == hash(normal->auxData, Mem::MAX_SIZE) &&
+                hash(&mem->lcBank1[0][0], sizeof(mem->lcBank1)) == hash(&normal->lcBank1[0][0], sizeof(normal->lcBank1));
+
+        for(int row = 0 ; row < 24 && match ; row++)
+            match = screenLine(mem, row) == screenLine(normal, row);
+    }
+
+    delete machine;
+
+    return match;
+}
+
+// Run one emulator instance, returns its JSON result line
+static std::string run(const Rom* rom, const Job& job, int index, bool fastDisk, bool checkFast) {
+
+    Machine* machine = new Machine(rom);
+    machine->disk->fastMode = fastDisk;
+    Mem* mem = machine->mem;
+    CPU* cpu = machine->cpu;
+
+    std::ostringstream out;
+
+    out << "{\"index\":" << index << ",\"disk\":" << jsonString(job.disk);
+
+    bool ok = true;
+
+    // Runs may share an image, what they write stays in memory
+    if(job.disk != "-" && machine->loadDisk(job.disk, false) != 0) {
+        out << ",\"error\":\"could not load disk image\"";
+        ok = false;
+    }
+
+    if(ok) {
+        machine->reset();
+        cpu->emulateUntil(job.cycles);
+
+        out << ",\"cycles\":" << cpu->cycleStamp
+            << ",\"pc\":" << (int)cpu->pc
+            << ",\"a\":" << (int)cpu->a
+            << ",\"x\":" << (int)cpu->x
+            << ",\"y\":" << (int)cpu->y
+            << ",\"sp\":" << (int)cpu->sp
+            << ",\"p\":" << (int)cpu->getFlagRegister()
+            << ",\"main_hash\":" << hex(hash(mem->data, Mem::MAX_SIZE))
+            << ",\"aux_hash\":" << hex(hash(mem->auxData, Mem::MAX_SIZE))
+            << ",\"screen\":[";
+
+        for(int row = 0 ; row < 24 ; row++)
+            out << (row ? "," : "") << jsonString(screenLine(mem, row));
+
+        out << "]";
+
+        if(checkFast && job.disk != "-") {
+            bool match = fastDiskMatches(rom, job, mem);
+
+            if(!match)
+                fastMismatches++;
+
+            out << ",\"fast_match\":" << (match ? "true" : "false");
+        }
+    }
+
+    out << "}\n";
+
+    delete machine;
+
+    return out.str();
+}
+
+static bool readJobs(std::string filename, uint64 cycles, std::vector<Job>& jobs) {
+    std::ifstream in(filename);
+
+    if(!in.is_open())
+        return false;
+
+    std::string line;
+
+    while(std::getline(in, line)) {
+        std::istringstream fields(line);
+        Job job = {"", cycles};
+
+        if(!(fields >> job.disk) || job.disk[0] == '#')
+            continue;
+
+        fields >> job.cycles;
+        jobs.push_back(job);
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+
+    int threads = std::thread::hardware_concurrency();
+    uint64 cycles = DEFAULT_CYCLES;
+    std::string romFile;
+    bool fastDisk = false;
+    bool checkFast = false;
+    std::vector<Job> jobs;
+
+    for(int i = 1 ; i < argc ; i++) {
+        std::string arg = argv[i];
+
+        if(arg == "-j" && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if(arg == "-c" && i + 1 < argc)
+            cycles = strtoull(argv[++i], nullptr, 0);
+        else if(arg == "-r" && i + 1 < argc)
+            romFile = argv[++i];
+        else if(arg == "-F")
+            fastDisk = true;
+        else if(arg == "-C")
+            checkFast = true;
+        else if(arg == "-f" && i + 1 < argc) {
+            if(!readJobs(argv[++i], cycles, jobs)) {
+                std::cerr << "Could not read job file " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else
+            jobs.push_back({arg, cycles});
+    }
+
+    if(jobs.empty()) {
+        std::cerr << "Usage : " << argv[0] << " [-j threads] [-c cycles] [-r rom] [-F] [-C] [-f jobfile] [disk ...]" << std::endl;
+        return 1;
+    }
+
+    if(threads < 1)
+        threads = 1;
+
+    // Loaded once, shared read-only by every machine
+    Rom* rom = Machine::loadSystemRom(romFile);
+
+    if(!rom->loaded) {
+        delete rom;
+        return 1;
+    }
+
+    // Emulator log messages would interleave with the results
+    logEnabled = false;
+
+    std::atomic<size_t> nextJob(0);
+    std::mutex outputLock;
+
+    auto worker = [&]() {
+        for(size_t i = nextJob++ ; i < jobs.size() ; i = nextJob++) {
+            std::string result = run(rom, jobs[i], i, fastDisk, checkFast);
+
+            std::lock_guard<std::mutex> lock(outputLock);
+            fputs(result.c_str(), stdout);
+            fflush(stdout);
+        }
+    };
+
+    std::vector<std::thread> pool;
+
+    for(int i = 0 ; i < threads ; i++)
+        pool.push_back(std::thread(worker));
+
+    for(std::thread& thread : pool)
+        thread.join();
+
+    delete rom;
+
+    return fastMismatches ? 1 : 0;
+}
@@ -0,0 +1,10 @@
+/**
+ * Headless tests
+ * Memory map checks that need no ROM file, built and run by "make test".
+ */
+
+#include "test.hpp"
+
+int main() {
+    return TestSuite::memoryTests();
+}
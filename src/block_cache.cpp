@@ -0,0 +1,172 @@
+#include "block_cache.hpp"
+#include "jit.hpp"
+
+BlockCache::BlockCache(CPU* cpu) {
+    this->cpu = cpu;
+    this->mem = cpu->mem;
+
+    for(int i = 0 ; i < 0x10000 ; i++)
+        blocks[i] = nullptr;
+
+    jit = CPU_JIT ? new JIT(cpu, this) : nullptr;
+
+    clear();
+}
+
+BlockCache::~BlockCache() {
+    for(int i = 0 ; i < 0x10000 ; i++)
+        delete blocks[i];
+
+#if CPU_JIT
+    delete jit;
+#endif
+}
+
+void BlockCache::clear() {
+    for(int page = 0 ; page < 0x100 ; page++)
+        rewrites[page] = 0;
+}
+
+// Check that the pages under a block still hold the code it was decoded from
+bool BlockCache::valid(Block* block) {
+    return  mem->readPages[block->firstPage] == block->pageData[0] &&
+            mem->readPages[block->lastPage] == block->pageData[1] &&
+            mem->pageVersion[block->firstPage] == block->pageVersion[0] &&
+            mem->pageVersion[block->lastPage] == block->pageVersion[1];
+}
+
+// Decode instructions starting at pc into a block
+// Reuses the given block if not null, returns null if nothing can be decoded
+Block* BlockCache::decode(word pc, Block* block) {
+
+    byte firstPage = pc >> 8;
+    byte nextPage = firstPage + 1;
+
+    // Code is never decoded from the I/O page
+    if(!mem->readPages[firstPage])
+        return nullptr;
+
+    if(!block) {
+        block = new Block();
+        blocks[pc] = block;
+    }
+
+    block->start = pc;
+    block->firstPage = firstPage;
+    block->lastPage = firstPage;
+    block->count = 0;
+    block->maxCycles = 0;
+    block->hits = 0;
+    block->code = nullptr;
+
+    word addr = pc;
+
+    while(block->count < Block::MAX_OPS) {
+
+        byte opcode = mem->readPages[addr >> 8][addr & 0xff];
+        const Instruction& instruction = instructions[opcode];
+
+        // Operand bytes must stay on the first two pages, outside of the I/O page
+        word end = addr + instruction.operandSize;
+        byte endPage = end >> 8;
+
+        if((endPage != firstPage && endPage != nextPage) || !mem->readPages[endPage])
+            break;
+
+        word operand = 0;
+
+        if(instruction.operandSize >= 1)
+            operand = mem->readPages[(word)(addr + 1) >> 8][(addr + 1) & 0xff];
+
+        if(instruction.operandSize == 2)
+            operand |= mem->readPages[end >> 8][end & 0xff] << 8;
+
+        MicroOp& op = block->ops[block->count++];
+
+        op.execute = instruction.execute;
+        op.operand = operand;
+        op.length = 1 + instruction.operandSize;
+        op.cycles = cpu->cycleCount[opcode];
+        op.opcode = opcode;
+
+        block->maxCycles += op.cycles + 2;
+        block->lastPage = endPage;
+
+        if(instruction.endsBlock)
+            break;
+
+        // Next opcode must also be on the first two pages
+        addr = end + 1;
+
+        if((addr >> 8) != firstPage && (addr >> 8) != nextPage)
+            break;
+
+        if(!mem->readPages[addr >> 8])
+            break;
+    }
+
+    if(block->count == 0)
+        return nullptr;
+
+    // Writes to these pages now go through Mem::doWrite
+    mem->watchPage(block->firstPage);
+    mem->watchPage(block->lastPage);
+
+    block->pageData[0] = mem->readPages[block->firstPage];
+    block->pageData[1] = mem->readPages[block->lastPage];
+    block->pageVersion[0] = mem->pageVersion[block->firstPage];
+    block->pageVersion[1] = mem->pageVersion[block->lastPage];
+
+    return block;
+}
+
+// Run the block starting at PC
+bool BlockCache::run(long stop) {
+
+    word pc = cpu->pc;
+
+    if(rewrites[pc >> 8] > MAX_REWRITES)
+        return false;
+
+    Block* block = blocks[pc];
+
+    if(!block || !valid(block)) {
+
+        if(block)
+            rewrites[block->firstPage] ++;
+
+        block = decode(pc, block);
+
+        if(!block)
+            return false;
+    }
+
+    // Stop early if an instruction changes the memory map or writes to a watched page
+    uint32 version = mem->mapVersion;
+
+    int first = 0;
+
+#if CPU_JIT
+    // Compiled code never changes the memory map
+    // It does not check the clock either : only enter it if the block ends before stop
+    if(cpu->cycles - block->maxCycles >= stop)
+        first = jit->run(block);
+#endif
+
+    // Like the interpreter, stop at the first instruction boundary past stop
+    for(int i = first ; i < block->count && cpu->cycles > stop ; i++) {
+
+        const MicroOp& op = block->ops[i];
+
+        cpu->pc += op.length;
+        cpu->decrementCycles(op.cycles);
+        cpu->currentOpcode = op.opcode;
+
+        op.execute(cpu, op.operand);
+
+        if(mem->mapVersion != version)
+            break;
+    }
+
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef BLOCK_CACHE_HPP
+#define BLOCK_CACHE_HPP
+
+#include "types.hpp"
+#include "cpu_dispatch.hpp"
+
+// Pre-decoded instruction
+struct MicroOp {
+    InstructionHandler execute;
+    word operand;
+    byte length;            // Instruction length in bytes
+    byte cycles;            // Static cycle cost
+    byte opcode;
+};
+
+// Compiled code for the start of a block (jit.cpp)
+// Returns the number of instructions run, plus page cross cycles shifted left by 8
+typedef uint32 (*NativeCode)(CPU* cpu);
+
+struct JIT;
+
+// Straight-line run of instructions, ending at the first control flow change
+struct Block {
+
+    constexpr static int MAX_OPS = 32;
+
+    word start;
+
+    // A block spans at most two pages
+    // Read pointers and versions of both pages when the block was decoded
+    byte firstPage;
+    byte lastPage;
+    const byte* pageData[2];
+    uint32 pageVersion[2];
+
+    int count;
+    MicroOp ops[MAX_OPS];
+
+    // Most cycles the block can take, with taken branches and page crosses
+    int maxCycles;
+
+    // Number of runs, compiled code once hot
+    int hits;
+    NativeCode code;
+};
+
+// Decoded basic blocks, keyed by start address
+// Pages holding blocks are watched by Mem, a write to one of them bumps its
+// version and blocks on it are decoded again the next time they run.
+struct BlockCache {
+
+    // Pages rewritten more often than this are left to the interpreter
+    constexpr static int MAX_REWRITES = 64;
+
+    BlockCache(CPU* cpu);
+    ~BlockCache();
+
+    CPU* cpu;
+    Mem* mem;
+
+    Block* blocks[0x10000];
+
+    // Recompiler, with CPU_JIT
+    JIT* jit;
+
+    // Number of times blocks on each page were found stale
+    int rewrites[256];
+
+    // Run the block at PC, stopping once cycles reach stop
+    // Returns false if no block can be decoded there
+    bool run(long stop);
+
+    // Forget rewrite statistics
+    void clear();
+
+    bool valid(Block* block);
+    Block* decode(word pc, Block* block);
+};
+
+#endif
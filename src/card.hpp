@@ -0,0 +1,44 @@
+#ifndef CARD_HPP
+#define CARD_HPP
+
+#include "types.hpp"
+#include "scheduler.hpp"
+
+// Peripheral card in one of the slots 1 - 7
+// Slot n owns the I/O addresses $C0n0 - $C0nF (plus $80), its ROM page at $Cn00,
+// and may share $C800 - $CFFF with the other cards : the expansion ROM of the
+// last slot whose page was accessed is mapped there until $CFFF is accessed.
+struct Card {
+
+    const uint64* clock;    // CPU cycle counter, set by the machine
+    Scheduler* scheduler;   // Device events, set by the machine
+
+    Card() {
+        clock = nullptr;
+        scheduler = nullptr;
+    }
+
+    virtual ~Card() {}
+
+    // Current CPU cycle
+    uint64 now() const { return clock ? *clock : 0; }
+
+    // I/O, addr is $C090 - $C0FF
+    virtual byte ioRead(word addr) = 0;
+    virtual void ioWrite(word addr, byte value) = 0;
+
+    // ROM at $Cn00, 256 bytes, or null for an empty page
+    // Read again at every reset
+    virtual const byte* slotRom() { return nullptr; }
+
+    // ROM at $C800, 2 KB, or null if the card has none
+    virtual const byte* expansionRom() { return nullptr; }
+
+    // Machine reset
+    virtual void reset() {}
+
+    // Card about to be removed : cancel its pending events
+    virtual void detach() {}
+};
+
+#endif
@@ -1,4 +1,7 @@
 #include "cpu.hpp"
+#include "cpu_dispatch.hpp"
+#include "block_cache.hpp"
+#include "log.hpp"
 #include <iostream>
 #include <iomanip>
 #include <bitset>
@@ -8,6 +11,21 @@ CPU::CPU(Mem* mem) {
     this->mem = mem;
 
     ignoreCycles = false;
+
+    cycleStamp = 0;
+    cycleExact = false;
+
+    pendingIRQ = false;
+    pendingNMI = false;
+
+    blockCache = CPU_BLOCK_CACHE ? new BlockCache(this) : nullptr;
+}
+
+// Memory is owned by the caller
+CPU::~CPU() {
+#if CPU_BLOCK_CACHE
+    delete blockCache;
+#endif
 }
 
 void CPU::reset() {
@@ -22,91 +40,28 @@ void CPU::reset() {
 
     // Flag I is set
     setFlagRegister(0);
-    i = 1;
+    setInterrupt(true);
 
-    // Load ROMs into memory
+    // Load ROMs into memory, device events restart from now
+    mem->scheduler->now = cycleStamp;
     mem->init();
 
+    if(blockCache)
+        blockCache->clear();
+
     // Stack pointer starts at 0xfd
     sp = 0xfd;
 
     // Jump to reset vector
     pc = readWord(MOS6502_RESET);
 
-    std::cout << "Reset vector points to " << std::hex << pc << std::endl;
-}
-
-void CPU::decrementCycles(int cycles) {
-    if(!ignoreCycles)
-        this->cycles -= cycles;
-}
-
-bool CPU::checkPageCrossed(word addr, int offset) {
-    return (((addr + offset) & 0xff00) != (addr & 0xff00));
-}
-
-// Memory function wrappers
-
-byte CPU::readByte(uint32 addr) { return mem->readByte(addr); }
-word CPU::readWord(uint32 addr) { return mem->readWord(addr); }
-
-void CPU::writeByte(uint32 addr, byte b) { mem->writeByte(addr, b); }
-void CPU::writeWord(uint32 addr, word w) { mem->writeWord(addr, w); }
-
-byte CPU::nextByte() {
-    byte b = mem->readByte(pc);
-    pc ++;
-    return b;
-}
-
-word CPU::nextWord() {
-    word w = mem->readWord(pc);
-    pc += 2;
-    return w;
+    LOG("Reset vector points to " << std::hex << pc);
 }
 
 int CPU::loadFile(std::string filename, word addr, bool aux) {
     return mem->loadFile(filename, addr, aux);
 }
 
-// Zero-page addressing mode
-byte CPU::zeropage(byte offset) { return nextByte() + offset; }
-
-// Absolute addressing mode
-word CPU::absolute(word offset) {
-
-    word next = nextWord();
-
-    // Extra cycle for page boundary cross
-    if(!ignoreCycles && checkPageCrossed(next, offset))
-        decrementCycles(1);
-
-
-    return next + offset;
-}
-
-// Indirect addressing for JMP instruction
-word CPU::indirect() {
-    return mem->readWord(nextWord());
-}
-
-// Indexed indirect addressing
-word CPU::indexedIndirect() {
-    return mem->readWord((nextByte() + x) & 0xff);
-}
-
-// Indirect indexed addressing
-word CPU::indirectIndexed() {
-
-    byte next = nextByte();
-
-    // Extra cycle for page boundary cross
-    if(!ignoreCycles && checkPageCrossed(mem->readWord(next), y))
-        decrementCycles(1);
-
-    return mem->readWord(next) + y;
-}
-
 // BCD conversions
 byte CPU::binaryToDecimal(byte bin) {
     return (bin & 0x0f) + ((bin & 0xf0) >> 4) * 10;
@@ -116,42 +71,18 @@ byte CPU::decimalToBinary(byte dec) {
     return ((dec / 10) << 4 | (dec % 10));
 }
 
-// CPU flags
-void CPU::setBreak(bool brk) { b = brk ? 1 : 0; }
-void CPU::setCarry(bool carry) { c = carry ? 1 : 0; }
-void CPU::setDecimal(bool decimal) { d = decimal ? 1 : 0; }
-void CPU::setNegative(bool negative) { n = negative ? 1 : 0; }
-void CPU::setOverflow(bool overflow) { v = overflow ? 1 : 0; }
-void CPU::setZero(bool zero) { z = zero ? 1 : 0; }
-void CPU::setInterrupt(bool in) { i = in ? 1 : 0; }
-
-// Update N and Z flags
-void CPU::setNZ(byte value) {
-    setNegative((value & 0x80) != 0);
-    setZero(value == 0);
-}
-
-void CPU::setAccN() { setNegative((a & 0x80) != 0); }
-void CPU::setAccZ() { setZero(a == 0); }
-
-void CPU::setAccNZ() { setNZ(a); }
-
 // Program counter
 void CPU::setPC(word pc) { this->pc = pc; }
 
 // Flag / status register
 byte CPU::getFlagRegister() {
-    return (n << 7) | (v << 6) | (1 << 5) | (b << 4) | (d << 3) | (i << 2) | (z << 1) | c;
+    return (p & ~(FLAG_N | FLAG_Z)) | FLAG_U | (nResult & FLAG_N) | (zero() << 1);
 }
 
 void CPU::setFlagRegister(byte flags) {
-    n = (flags >> 7) ;
-    v = (flags >> 6) & 1;
-    b = (flags >> 4) & 1;
-    d = (flags >> 3) & 1;
-    i = (flags >> 2) & 1;
-    z = (flags >> 1) & 1;
-    c = (flags) & 1;
+    p = flags & ~(FLAG_N | FLAG_Z);
+    setNegative(flags & FLAG_N);
+    setZero(flags & FLAG_Z);
 }
 
 // Stack push / pop
@@ -180,9 +111,52 @@ void CPU::emulateCycles(long cyclesToEmulate) {
     // Add new cycles to emulate
     cycles += cyclesToEmulate;
 
-    while (cycles > 0) {
-        //printOpcode(readWord(pc));
-        emulateInstruction();
+    runCycles();
+}
+
+// Emulate up to a point in time, e.g. the start of the next frame
+void CPU::emulateUntil(uint64 stamp) {
+    cycles = stamp > cycleStamp ? stamp - cycleStamp : 0;
+
+    runCycles();
+}
+
+// Run the pending cycles, stopping at each scheduled device event
+void CPU::runCycles() {
+
+    Scheduler* scheduler = mem->scheduler;
+
+    while (true) {
+
+        // Events due, including those falling on the last cycle
+        if(cycleStamp >= scheduler->next)
+            scheduler->run(cycleStamp);
+
+        if(cycles <= 0)
+            break;
+
+        // Run instructions up to the next event or the end of the slice
+        long stop = 0;
+
+        if(scheduler->next - cycleStamp < (uint64)cycles)
+            stop = cycles - (long)(scheduler->next - cycleStamp);
+
+        while (cycles > stop) {
+            //printOpcode(readWord(pc));
+
+            if(cycleExact) {
+                emulateInstructionExact();
+                continue;
+            }
+
+#if CPU_BLOCK_CACHE
+            // Interrupts and debugging go through the interpreter
+            if(!pendingNMI && !pendingIRQ && !debug && blockCache->run(stop))
+                continue;
+#endif
+
+            emulateInstruction();
+        }
     }
 }
 
@@ -213,6 +187,9 @@ void CPU::emulateInstruction() {
 
     currentOpcode = opcode;
 
+#if CPU_THREADED_DISPATCH
+    instructions[opcode].dispatch(this);
+#else
     switch(opcode) {
 
         // ADC
@@ -237,33 +214,33 @@ void CPU::emulateInstruction() {
 
         // ASL
         case 0x0a: asl(&a); break;                                                          //ASL a
-        case 0x06: asl(mem->getAddr(zeropage(0))); break;                                   //ASL a8
-        case 0x16: asl(mem->getAddr(zeropage(x))); break;                                   //ASL a8,X
-        case 0x0e: asl(mem->getAddr(absolute(0))); break;                                   //ASL a16
-        case 0x1e: asl(mem->getAddr(absolute(x))); break;                                   //ASL a16,X
+        case 0x06: modify<&CPU::asl>(zeropage(0)); break;                                   //ASL a8
+        case 0x16: modify<&CPU::asl>(zeropage(x)); break;                                   //ASL a8,X
+        case 0x0e: modify<&CPU::asl>(absolute(0)); break;                                   //ASL a16
+        case 0x1e: modify<&CPU::asl>(absolute(x)); break;                                   //ASL a16,X
 
         // BIT
         case 0x24: bit(readByte(zeropage(0))); break;                                       //BIT a8
         case 0x2c: bit(readByte(absolute(0))); break;                                       //BIT a16
 
         // Branches
-        case 0x90: condBranch(!c); break;                                                   //BCC
-        case 0xb0: condBranch(c); break;                                                    //BCS
-        case 0xf0: condBranch(z); break;                                                    //BEQ
-        case 0x30: condBranch(n); break;                                                    //BMI
-        case 0xd0: condBranch(!z); break;                                                   //BNE
-        case 0x10: condBranch(!n); break;                                                   //BPL
-        case 0x50: condBranch(!v); break;                                                   //BVC
-        case 0x70: condBranch(v); break;                                                    //BVS
+        case 0x90: condBranch(!carry()); break;                                                   //BCC
+        case 0xb0: condBranch(carry()); break;                                                    //BCS
+        case 0xf0: condBranch(zero()); break;                                                    //BEQ
+        case 0x30: condBranch(negative()); break;                                                    //BMI
+        case 0xd0: condBranch(!zero()); break;                                                   //BNE
+        case 0x10: condBranch(!negative()); break;                                                   //BPL
+        case 0x50: condBranch(!overflow()); break;                                                   //BVC
+        case 0x70: condBranch(overflow()); break;                                                    //BVS
 
         // BRK
         case 0x00: brk(); break;                                                            //BRK
 
         // Clear flags
-        case 0x18: c = 0; break;                                                            //CLC
-        case 0xd8: d = 0; break;                                                            //CLD
-        case 0x58: i = 0; break;                                                            //CLI
-        case 0xb8: v = 0; break;                                                            //CLV
+        case 0x18: setCarry(false); break;                                                  //CLC
+        case 0xd8: setDecimal(false); break;                                                //CLD
+        case 0x58: setInterrupt(false); break;                                              //CLI
+        case 0xb8: setOverflow(false); break;                                               //CLV
 
         // CMP
         case 0xc9: cmp(a, nextByte()); break;                                               //CMP #d8
@@ -286,10 +263,10 @@ void CPU::emulateInstruction() {
         case 0xcc: cmp(y, readByte(absolute(0))); break;                                    //CPY a16
 
         // DEC
-        case 0xc6: dec(mem->getAddr(zeropage(0))); break;                                   //DEC a8
-        case 0xd6: dec(mem->getAddr(zeropage(x))); break;                                   //DEC a8,X
-        case 0xce: dec(mem->getAddr(absolute(0))); break;                                   //DEC a16
-        case 0xde: dec(mem->getAddr(absolute(x))); break;                                   //DEC a16,X
+        case 0xc6: modify<&CPU::dec>(zeropage(0)); break;                                   //DEC a8
+        case 0xd6: modify<&CPU::dec>(zeropage(x)); break;                                   //DEC a8,X
+        case 0xce: modify<&CPU::dec>(absolute(0)); break;                                   //DEC a16
+        case 0xde: modify<&CPU::dec>(absolute(x)); break;                                   //DEC a16,X
 
         // DEX
         case 0xca: dec(&x); break;                                                          //DEX
@@ -308,10 +285,10 @@ void CPU::emulateInstruction() {
         case 0x51: eor(readByte(indirectIndexed())); break;                                 //EOR (a8),Y
 
         // INC
-        case 0xe6: inc(mem->getAddr(zeropage(0))); break;                                   //INC a8
-        case 0xf6: inc(mem->getAddr(zeropage(x))); break;                                   //INC a8,X
-        case 0xee: inc(mem->getAddr(absolute(0))); break;                                   //INC a16
-        case 0xfe: inc(mem->getAddr(absolute(x))); break;                                   //INC a16,X
+        case 0xe6: modify<&CPU::inc>(zeropage(0)); break;                                   //INC a8
+        case 0xf6: modify<&CPU::inc>(zeropage(x)); break;                                   //INC a8,X
+        case 0xee: modify<&CPU::inc>(absolute(0)); break;                                   //INC a16
+        case 0xfe: modify<&CPU::inc>(absolute(x)); break;                                   //INC a16,X
 
         // INX
         case 0xe8: inc(&x); break;                                                          //INX
@@ -352,10 +329,10 @@ void CPU::emulateInstruction() {
 
         // LSR
         case 0x4a: lsr(&a); break;                                                          //LSR a
-        case 0x46: lsr(mem->getAddr(zeropage(0))); break;                                   //LSR a8
-        case 0x56: lsr(mem->getAddr(zeropage(x))); break;                                   //LSR a8,X
-        case 0x4e: lsr(mem->getAddr(absolute(0))); break;                                   //LSR a16
-        case 0x5e: lsr(mem->getAddr(absolute(x))); break;                                   //LSR a16,X
+        case 0x46: modify<&CPU::lsr>(zeropage(0)); break;                                   //LSR a8
+        case 0x56: modify<&CPU::lsr>(zeropage(x)); break;                                   //LSR a8,X
+        case 0x4e: modify<&CPU::lsr>(absolute(0)); break;                                   //LSR a16
+        case 0x5e: modify<&CPU::lsr>(absolute(x)); break;                                   //LSR a16,X
 
         // NOP
         case 0xea: break;                                                                   //NOP
@@ -375,7 +352,7 @@ void CPU::emulateInstruction() {
         case 0x48: pushByte(a); break;                                                      //PHA
 
         // PHP
-        case 0x08: b = 1; pushByte(getFlagRegister()); break;                               //PHP
+        case 0x08: setBreak(true); pushByte(getFlagRegister()); break;                      //PHP
 
         // PLA
         case 0x68: a = popByte(); setAccNZ(); break;                                        //PLA
@@ -385,17 +362,17 @@ void CPU::emulateInstruction() {
 
         // ROL
         case 0x2a: rol(&a); break;                                                          //ROL a
-        case 0x26: rol(mem->getAddr(zeropage(0))); break;                                   //ROL a8
-        case 0x36: rol(mem->getAddr(zeropage(x))); break;                                   //ROL a8,X
-        case 0x2e: rol(mem->getAddr(absolute(0))); break;                                   //ROL a16
-        case 0x3e: rol(mem->getAddr(absolute(x))); break;                                   //ROL a16,X
+        case 0x26: modify<&CPU::rol>(zeropage(0)); break;                                   //ROL a8
+        case 0x36: modify<&CPU::rol>(zeropage(x)); break;                                   //ROL a8,X
+        case 0x2e: modify<&CPU::rol>(absolute(0)); break;                                   //ROL a16
+        case 0x3e: modify<&CPU::rol>(absolute(x)); break;                                   //ROL a16,X
 
         // ROR
         case 0x6a: ror(&a); break;                                                          //ROR a
-        case 0x66: ror(mem->getAddr(zeropage(0))); break;                                   //ROR a8
-        case 0x76: ror(mem->getAddr(zeropage(x))); break;                                   //ROR a8,X
-        case 0x6e: ror(mem->getAddr(absolute(0))); break;                                   //ROR a16
-        case 0x7e: ror(mem->getAddr(absolute(x))); break;                                   //ROR a16,X
+        case 0x66: modify<&CPU::ror>(zeropage(0)); break;                                   //ROR a8
+        case 0x76: modify<&CPU::ror>(zeropage(x)); break;                                   //ROR a8,X
+        case 0x6e: modify<&CPU::ror>(absolute(0)); break;                                   //ROR a16
+        case 0x7e: modify<&CPU::ror>(absolute(x)); break;                                   //ROR a16,X
 
         // RTI
         case 0x40: rti(); break;                                                            //RTI
@@ -414,9 +391,9 @@ void CPU::emulateInstruction() {
         case 0xf1: sbc(readByte(indirectIndexed())); break;                                 //SBC (a8),Y
 
         // Set flags
-        case 0x38: c = 1; break;                                                            //SEC
-        case 0xf8: d = 1; break;                                                            //SED
-        case 0x78: i = 1; break;                                                            //SEI
+        case 0x38: setCarry(true); break;                                                   //SEC
+        case 0xf8: setDecimal(true); break;                                                 //SED
+        case 0x78: setInterrupt(true); break;                                               //SEI
 
         // STA
         case 0x85: writeByte(zeropage(0), a); break;                                        //STA a8
@@ -446,8 +423,9 @@ void CPU::emulateInstruction() {
         case 0x98: a = y; setAccNZ(); break;                                                //TYA
 
         // Unknown opcode
-        default : std::cout << "Unknown opcode: " << std::hex << std::setw(2) << (int)opcode << " at pc " << std::setw(4) << (int) pc << std::endl;
+        default : LOG("Unknown opcode: " << std::hex << std::setw(2) << (int)opcode << " at pc " << std::setw(4) << (int) pc);
     }
+#endif
 }
 
 // Print A, X, Y, SP and status registers
@@ -9,16 +9,63 @@
 #define MOS6502_RESET 0xfffc
 #define MOS6502_IRQ_BRK 0xfffe
 
+// Instruction dispatch
+// 0 : switch over opcodes in emulateInstruction
+// 1 : table of per-opcode handlers (cpu_dispatch.cpp)
+#ifndef CPU_THREADED_DISPATCH
+#define CPU_THREADED_DISPATCH 0
+#endif
+
+// Basic block cache
+// 1 : emulateCycles runs pre-decoded blocks (block_cache.cpp)
+#ifndef CPU_BLOCK_CACHE
+#define CPU_BLOCK_CACHE 0
+#endif
+
+// x86-64 recompiler for hot blocks, implies the block cache
+// 1 : run compiled code (jit.cpp)
+// 2 : differential test, check compiled code against the interpreter
+#ifndef CPU_JIT
+#define CPU_JIT 0
+#endif
+
+#if CPU_JIT && !(defined(__x86_64__) && !defined(_WIN32))
+#warning "CPU_JIT needs a x86-64 System V target, disabled"
+#undef CPU_JIT
+#define CPU_JIT 0
+#endif
+
+#if CPU_JIT
+#undef CPU_BLOCK_CACHE
+#define CPU_BLOCK_CACHE 1
+#endif
+
+struct BlockCache;
+
 struct CPU {
 
     // Constructor
     CPU(Mem* mem);
+    ~CPU();
 
     // Registers
     byte a, x, y;
 
-    // Status flag bits
-    byte n, v, b, d, i, z, c;
+    // Status register
+    // N and Z are not kept in p, they are derived from the last result when read :
+    // N is bit 7 of nResult, Z is set when zResult is 0.
+    byte p;
+    byte nResult, zResult;
+
+    // Status register bits
+    constexpr static byte FLAG_C = 0x01;
+    constexpr static byte FLAG_Z = 0x02;
+    constexpr static byte FLAG_I = 0x04;
+    constexpr static byte FLAG_D = 0x08;
+    constexpr static byte FLAG_B = 0x10;
+    constexpr static byte FLAG_U = 0x20;
+    constexpr static byte FLAG_V = 0x40;
+    constexpr static byte FLAG_N = 0x80;
 
     // Stack pointer
     byte sp;
@@ -29,6 +76,9 @@ struct CPU {
     // RAM
     Mem* mem;
 
+    // Decoded blocks
+    BlockCache* blockCache;
+
     // Interrupts pending
     bool pendingIRQ;
     bool pendingNMI;
@@ -42,6 +92,14 @@ struct CPU {
     // Number of cycles to emulate
     long cycles;
 
+    // Cycles elapsed since power on, time base for devices
+    uint64 cycleStamp;
+
+    // Cycle-exact mode, off by default
+    // Each bus access takes one cycle and happens at its true position in the
+    // instruction, dummy reads and writes included (cpu_exact.cpp).
+    bool cycleExact;
+
     // Cycle count for each instruction
     int cycleCount[256] = {
     //  0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f
@@ -97,6 +155,7 @@ struct CPU {
     // Read memory
     byte readByte(uint32 addr);
     word readWord(uint32 addr);
+    word readPointer(word addr);
 
     void writeByte(uint32 addr, byte b);
     void writeWord(uint32 addr, word w);
@@ -118,7 +177,16 @@ struct CPU {
     byte binaryToDecimal(byte bin);
     byte decimalToBinary(byte bin);
 
+    // Read flags, 0 or 1
+    byte carry();
+    byte zero();
+    byte interrupt();
+    byte decimal();
+    byte overflow();
+    byte negative();
+
     // Set flags
+    void setFlag(byte mask, bool set);
     void setCarry(bool carry);
     void setOverflow(bool overflow);
     void setNegative(bool negative);
@@ -150,6 +218,29 @@ struct CPU {
     // Emulate instructions
     void emulateInstruction();
     void emulateCycles(long cyclesToEmulate);
+    void emulateUntil(uint64 stamp);
+    void runCycles();
+
+    // Cycle-exact mode
+    void emulateInstructionExact();
+
+    byte busRead(word addr);
+    void busWrite(word addr, byte value);
+    void busIdle();
+    void busPush(byte value);
+    byte busPull();
+
+    word exactZeropage();
+    word exactZeropageIndexed(byte index);
+    word exactAbsolute();
+    word exactAbsoluteIndexed(byte index, bool write);
+    word exactIndexedIndirect();
+    word exactIndirectIndexed(bool write);
+
+    template<void (CPU::*op)(byte*)> void exactModify(word addr);
+
+    void exactBranch(bool taken);
+    void exactInterrupt(word vector, bool brk);
 
     // Print information
     void printOpcode(word opcode);
@@ -163,6 +254,9 @@ struct CPU {
     void handleIRQ();
     void handleNMI();
 
+    // Read-modify-write instruction on memory
+    template<void (CPU::*op)(byte*)> void modify(word addr);
+
     // Instructions
     void adc(byte operand);
     void and_(byte operand);
@@ -170,6 +264,7 @@ struct CPU {
     void bit(byte operand);
     void branch(signed_byte offset);
     void condBranch(byte flag);
+    void condBranch(byte flag, signed_byte offset);
 
     void brk();
 
@@ -200,4 +295,133 @@ struct CPU {
 
 };
 
+// Memory function wrappers
+// Inlined so fetches and operands go straight to the page tables
+
+inline byte CPU::readByte(uint32 addr) { return mem->readByte(addr); }
+inline word CPU::readWord(uint32 addr) { return mem->readWord(addr); }
+
+// Pointer of JMP (a16), (a8,X) and (a8),Y : the high byte is read from the same page
+inline word CPU::readPointer(word addr) {
+    return mem->readByte(addr) | (mem->readByte((addr & 0xff00) | ((addr + 1) & 0xff)) << 8);
+}
+
+inline void CPU::writeByte(uint32 addr, byte b) { mem->writeByte(addr, b); }
+inline void CPU::writeWord(uint32 addr, word w) { mem->writeWord(addr, w); }
+
+inline byte CPU::nextByte() {
+    byte b = mem->readByte(pc);
+    pc ++;
+    return b;
+}
+
+inline word CPU::nextWord() {
+    word w = mem->readWord(pc);
+    pc += 2;
+    return w;
+}
+
+// Read-modify-write
+// Ordinary RAM is modified in place. Anything else (I/O, ROM, watched code,
+// split read/write banks) gets the 6502 bus sequence : read, write back the
+// unmodified value, write the result.
+template<void (CPU::*op)(byte*)>
+inline void CPU::modify(word addr) {
+    byte page = addr >> 8;
+    byte* ram = mem->writePages[page];
+
+    if(ram && ram == mem->readPages[page]) {
+        (this->*op)(ram + (addr & 0xff));
+        return;
+    }
+
+    byte value = mem->readByte(addr);
+    mem->writeByte(addr, value);
+
+    (this->*op)(&value);
+
+    mem->writeByte(addr, value);
+}
+
+// Flags
+
+inline byte CPU::carry()     { return p & FLAG_C; }
+inline byte CPU::zero()      { return zResult == 0; }
+inline byte CPU::interrupt() { return (p >> 2) & 1; }
+inline byte CPU::decimal()   { return (p >> 3) & 1; }
+inline byte CPU::overflow()  { return (p >> 6) & 1; }
+inline byte CPU::negative()  { return nResult >> 7; }
+
+inline void CPU::setFlag(byte mask, bool set) { p = set ? (p | mask) : (p & ~mask); }
+
+inline void CPU::setCarry(bool carry)         { setFlag(FLAG_C, carry); }
+inline void CPU::setDecimal(bool decimal)     { setFlag(FLAG_D, decimal); }
+inline void CPU::setOverflow(bool overflow)   { setFlag(FLAG_V, overflow); }
+inline void CPU::setBreak(bool brk)           { setFlag(FLAG_B, brk); }
+inline void CPU::setInterrupt(bool in)        { setFlag(FLAG_I, in); }
+inline void CPU::setNegative(bool negative)   { nResult = negative ? 0x80 : 0; }
+inline void CPU::setZero(bool zero)           { zResult = zero ? 0 : 1; }
+
+// Update N and Z flags, only the result is stored
+inline void CPU::setNZ(byte value) {
+    nResult = value;
+    zResult = value;
+}
+
+inline void CPU::setAccN() { nResult = a; }
+inline void CPU::setAccZ() { zResult = a; }
+inline void CPU::setAccNZ() { setNZ(a); }
+
+// Cycles
+
+inline void CPU::decrementCycles(int cycles) {
+    cycleStamp += cycles;
+
+    if(!ignoreCycles)
+        this->cycles -= cycles;
+}
+
+inline bool CPU::checkPageCrossed(word addr, int offset) {
+    return (((addr + offset) & 0xff00) != (addr & 0xff00));
+}
+
+// Addressing modes
+
+// Zero-page addressing mode
+inline byte CPU::zeropage(byte offset) { return nextByte() + offset; }
+
+// Absolute addressing mode
+inline word CPU::absolute(word offset) {
+
+    word next = nextWord();
+
+    // Extra cycle for page boundary cross, only for reads
+    if(pageCrossOpcodes[currentOpcode] && !ignoreCycles && checkPageCrossed(next, offset))
+        decrementCycles(1);
+
+    return next + offset;
+}
+
+// Indirect addressing for JMP instruction
+inline word CPU::indirect() {
+    return readPointer(nextWord());
+}
+
+// Indexed indirect addressing
+inline word CPU::indexedIndirect() {
+    return readPointer((nextByte() + x) & 0xff);
+}
+
+// Indirect indexed addressing
+inline word CPU::indirectIndexed() {
+
+    word base = readPointer(nextByte());
+
+    // Extra cycle for page boundary cross, only for reads
+    if(pageCrossOpcodes[currentOpcode] && !ignoreCycles && checkPageCrossed(base, y))
+        decrementCycles(1);
+
+    return base + y;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,246 @@
+#include "cpu_dispatch.hpp"
+#include "log.hpp"
+#include <iostream>
+#include <iomanip>
+
+// Table-driven instruction dispatch
+// Each opcode gets its own handler, instantiated from a template per
+// instruction with the addressing mode and register as template arguments.
+// Handlers receive their operand already fetched, so the same table serves
+// CPU::emulateInstruction (CPU_THREADED_DISPATCH) and the block cache.
+
+namespace {
+
+enum AddressingMode {
+    IMM,    // #d8
+    ZP,     // a8
+    ZPX,    // a8,X
+    ZPY,    // a8,Y
+    ABS,    // a16
+    ABX,    // a16,X
+    ABY,    // a16,Y
+    IZX,    // (a8,X)
+    IZY     // (a8),Y
+};
+
+// Indexed absolute address, with an extra cycle for page boundary cross on reads
+inline word indexed(CPU* cpu, word base, byte offset) {
+    if(cpu->pageCrossOpcodes[cpu->currentOpcode] && !cpu->ignoreCycles && cpu->checkPageCrossed(base, offset))
+        cpu->decrementCycles(1);
+
+    return base + offset;
+}
+
+// Effective address
+template<int mode>
+inline word address(CPU* cpu, word operand) {
+    switch(mode) {
+        case ZP:  return operand & 0xff;
+        case ZPX: return (operand + cpu->x) & 0xff;
+        case ZPY: return (operand + cpu->y) & 0xff;
+        case ABS: return operand;
+        case ABX: return indexed(cpu, operand, cpu->x);
+        case ABY: return indexed(cpu, operand, cpu->y);
+        case IZX: return cpu->readPointer((operand + cpu->x) & 0xff);
+        case IZY: return indexed(cpu, cpu->readPointer(operand & 0xff), cpu->y);
+        default:  return 0;
+    }
+}
+
+// Operand value
+template<int mode>
+inline byte value(CPU* cpu, word operand) {
+    if(mode == IMM)
+        return operand;
+
+    return cpu->readByte(address<mode>(cpu, operand));
+}
+
+// Instructions
+
+template<int mode> void ADC(CPU* cpu, word op) { cpu->adc(value<mode>(cpu, op)); }
+template<int mode> void AND(CPU* cpu, word op) { cpu->and_(value<mode>(cpu, op)); }
+template<int mode> void BIT(CPU* cpu, word op) { cpu->bit(value<mode>(cpu, op)); }
+template<int mode> void EOR(CPU* cpu, word op) { cpu->eor(value<mode>(cpu, op)); }
+template<int mode> void ORA(CPU* cpu, word op) { cpu->ora(value<mode>(cpu, op)); }
+template<int mode> void SBC(CPU* cpu, word op) { cpu->sbc(value<mode>(cpu, op)); }
+
+template<byte CPU::*reg, int mode> void CMP(CPU* cpu, word op) { cpu->cmp(cpu->*reg, value<mode>(cpu, op)); }
+template<byte CPU::*reg, int mode> void LD(CPU* cpu, word op)  { cpu->ld(&(cpu->*reg), value<mode>(cpu, op)); }
+template<byte CPU::*reg, int mode> void ST(CPU* cpu, word op)  { cpu->writeByte(address<mode>(cpu, op), cpu->*reg); }
+
+// Read-modify-write on memory
+template<int mode> void ASL(CPU* cpu, word op) { cpu->modify<&CPU::asl>(address<mode>(cpu, op)); }
+template<int mode> void LSR(CPU* cpu, word op) { cpu->modify<&CPU::lsr>(address<mode>(cpu, op)); }
+template<int mode> void ROL(CPU* cpu, word op) { cpu->modify<&CPU::rol>(address<mode>(cpu, op)); }
+template<int mode> void ROR(CPU* cpu, word op) { cpu->modify<&CPU::ror>(address<mode>(cpu, op)); }
+template<int mode> void INC(CPU* cpu, word op) { cpu->modify<&CPU::inc>(address<mode>(cpu, op)); }
+template<int mode> void DEC(CPU* cpu, word op) { cpu->modify<&CPU::dec>(address<mode>(cpu, op)); }
+
+// Accumulator and register variants
+void ASL_A(CPU* cpu, word op) { cpu->asl(&cpu->a); }
+void LSR_A(CPU* cpu, word op) { cpu->lsr(&cpu->a); }
+void ROL_A(CPU* cpu, word op) { cpu->rol(&cpu->a); }
+void ROR_A(CPU* cpu, word op) { cpu->ror(&cpu->a); }
+
+template<byte CPU::*reg> void INR(CPU* cpu, word op) { cpu->inc(&(cpu->*reg)); }
+template<byte CPU::*reg> void DER(CPU* cpu, word op) { cpu->dec(&(cpu->*reg)); }
+
+// Branches
+template<byte (CPU::*flag)(), bool set> void BR(CPU* cpu, word op) {
+    cpu->condBranch(set ? (cpu->*flag)() : !(cpu->*flag)(), (signed_byte)op);
+}
+
+// Flags
+template<byte mask, bool state> void FLAG(CPU* cpu, word op) { cpu->setFlag(mask, state); }
+
+// Jumps and subroutines
+void BRK(CPU* cpu, word op)     { cpu->brk(); }
+void JMP(CPU* cpu, word op)     { cpu->jmp(op); }
+void JMP_IND(CPU* cpu, word op) { cpu->jmp(cpu->readPointer(op)); }
+void JSR(CPU* cpu, word op)     { cpu->jsr(op); }
+void RTI(CPU* cpu, word op)     { cpu->rti(); }
+void RTS(CPU* cpu, word op)     { cpu->rts(); }
+
+// Stack
+void PHA(CPU* cpu, word op) { cpu->pushByte(cpu->a); }
+void PHP(CPU* cpu, word op) { cpu->setBreak(true); cpu->pushByte(cpu->getFlagRegister()); }
+void PLA(CPU* cpu, word op) { cpu->a = cpu->popByte(); cpu->setAccNZ(); }
+void PLP(CPU* cpu, word op) { cpu->setFlagRegister(cpu->popByte()); }
+
+// Transfers
+void TAX(CPU* cpu, word op) { cpu->x = cpu->a; cpu->setAccNZ(); }
+void TAY(CPU* cpu, word op) { cpu->y = cpu->a; cpu->setAccNZ(); }
+void TSX(CPU* cpu, word op) { cpu->x = cpu->sp; cpu->setNZ(cpu->x); }
+void TXA(CPU* cpu, word op) { cpu->a = cpu->x; cpu->setAccNZ(); }
+void TXS(CPU* cpu, word op) { cpu->sp = cpu->x; }
+void TYA(CPU* cpu, word op) { cpu->a = cpu->y; cpu->setAccNZ(); }
+
+// No operation
+void NOP(CPU* cpu, word op) { }
+
+// Unknown opcode
+void UNK(CPU* cpu, word op) {
+    LOG("Unknown opcode: " << std::hex << std::setw(2) << (int)cpu->currentOpcode << " at pc " << std::setw(4) << (int) cpu->pc);
+}
+
+// Fetch the operand at PC, then run the instruction
+template<int size, InstructionHandler execute>
+void fetchAndExecute(CPU* cpu) {
+    word operand = 0;
+
+    if(size == 1)
+        operand = cpu->nextByte();
+    else if(size == 2)
+        operand = cpu->nextWord();
+
+    execute(cpu, operand);
+}
+
+// Opcode list : OP(opcode, operand size, ends block, handler)
+#define OPCODES(OP) \
+    /* ADC */ \
+    OP(0x69, 1, false, ADC<IMM>) OP(0x65, 1, false, ADC<ZP>)  OP(0x75, 1, false, ADC<ZPX>) OP(0x6d, 2, false, ADC<ABS>) \
+    OP(0x7d, 2, false, ADC<ABX>) OP(0x79, 2, false, ADC<ABY>) OP(0x61, 1, false, ADC<IZX>) OP(0x71, 1, false, ADC<IZY>) \
+    /* AND */ \
+    OP(0x29, 1, false, AND<IMM>) OP(0x25, 1, false, AND<ZP>)  OP(0x35, 1, false, AND<ZPX>) OP(0x2d, 2, false, AND<ABS>) \
+    OP(0x3d, 2, false, AND<ABX>) OP(0x39, 2, false, AND<ABY>) OP(0x21, 1, false, AND<IZX>) OP(0x31, 1, false, AND<IZY>) \
+    /* ASL */ \
+    OP(0x0a, 0, false, ASL_A)    OP(0x06, 1, false, ASL<ZP>)  OP(0x16, 1, false, ASL<ZPX>) OP(0x0e, 2, false, ASL<ABS>) \
+    OP(0x1e, 2, false, ASL<ABX>) \
+    /* BIT */ \
+    OP(0x24, 1, false, BIT<ZP>)  OP(0x2c, 2, false, BIT<ABS>) \
+    /* Branches */ \
+    OP(0x90, 1, true, BR<&CPU::carry, false>) OP(0xb0, 1, true, BR<&CPU::carry, true>) \
+    OP(0xd0, 1, true, BR<&CPU::zero, false>) OP(0xf0, 1, true, BR<&CPU::zero, true>) \
+    OP(0x10, 1, true, BR<&CPU::negative, false>) OP(0x30, 1, true, BR<&CPU::negative, true>) \
+    OP(0x50, 1, true, BR<&CPU::overflow, false>) OP(0x70, 1, true, BR<&CPU::overflow, true>) \
+    /* BRK (fetches its padding byte itself) */ \
+    OP(0x00, 0, true, BRK) \
+    /* Clear and set flags */ \
+    OP(0x18, 0, false, FLAG<CPU::FLAG_C, 0>) OP(0xd8, 0, false, FLAG<CPU::FLAG_D, 0>) \
+    OP(0x58, 0, false, FLAG<CPU::FLAG_I, 0>) OP(0xb8, 0, false, FLAG<CPU::FLAG_V, 0>) \
+    OP(0x38, 0, false, FLAG<CPU::FLAG_C, 1>) OP(0xf8, 0, false, FLAG<CPU::FLAG_D, 1>) \
+    OP(0x78, 0, false, FLAG<CPU::FLAG_I, 1>) \
+    /* CMP */ \
+    OP(0xc9, 1, false, CMP<&CPU::a, IMM>) OP(0xc5, 1, false, CMP<&CPU::a, ZP>)  OP(0xd5, 1, false, CMP<&CPU::a, ZPX>) \
+    OP(0xcd, 2, false, CMP<&CPU::a, ABS>) OP(0xdd, 2, false, CMP<&CPU::a, ABX>) OP(0xd9, 2, false, CMP<&CPU::a, ABY>) \
+    OP(0xc1, 1, false, CMP<&CPU::a, IZX>) OP(0xd1, 1, false, CMP<&CPU::a, IZY>) \
+    /* CPX, CPY */ \
+    OP(0xe0, 1, false, CMP<&CPU::x, IMM>) OP(0xe4, 1, false, CMP<&CPU::x, ZP>)  OP(0xec, 2, false, CMP<&CPU::x, ABS>) \
+    OP(0xc0, 1, false, CMP<&CPU::y, IMM>) OP(0xc4, 1, false, CMP<&CPU::y, ZP>)  OP(0xcc, 2, false, CMP<&CPU::y, ABS>) \
+    /* DEC, DEX, DEY */ \
+    OP(0xc6, 1, false, DEC<ZP>)  OP(0xd6, 1, false, DEC<ZPX>) OP(0xce, 2, false, DEC<ABS>) OP(0xde, 2, false, DEC<ABX>) \
+    OP(0xca, 0, false, DER<&CPU::x>) OP(0x88, 0, false, DER<&CPU::y>) \
+    /* EOR */ \
+    OP(0x49, 1, false, EOR<IMM>) OP(0x45, 1, false, EOR<ZP>)  OP(0x55, 1, false, EOR<ZPX>) OP(0x4d, 2, false, EOR<ABS>) \
+    OP(0x5d, 2, false, EOR<ABX>) OP(0x59, 2, false, EOR<ABY>) OP(0x41, 1, false, EOR<IZX>) OP(0x51, 1, false, EOR<IZY>) \
+    /* INC, INX, INY */ \
+    OP(0xe6, 1, false, INC<ZP>)  OP(0xf6, 1, false, INC<ZPX>) OP(0xee, 2, false, INC<ABS>) OP(0xfe, 2, false, INC<ABX>) \
+    OP(0xe8, 0, false, INR<&CPU::x>) OP(0xc8, 0, false, INR<&CPU::y>) \
+    /* JMP, JSR */ \
+    OP(0x4c, 2, true, JMP) OP(0x6c, 2, true, JMP_IND) OP(0x20, 2, true, JSR) \
+    /* LDA */ \
+    OP(0xa9, 1, false, LD<&CPU::a, IMM>) OP(0xa5, 1, false, LD<&CPU::a, ZP>)  OP(0xb5, 1, false, LD<&CPU::a, ZPX>) \
+    OP(0xad, 2, false, LD<&CPU::a, ABS>) OP(0xbd, 2, false, LD<&CPU::a, ABX>) OP(0xb9, 2, false, LD<&CPU::a, ABY>) \
+    OP(0xa1, 1, false, LD<&CPU::a, IZX>) OP(0xb1, 1, false, LD<&CPU::a, IZY>) \
+    /* LDX */ \
+    OP(0xa2, 1, false, LD<&CPU::x, IMM>) OP(0xa6, 1, false, LD<&CPU::x, ZP>)  OP(0xb6, 1, false, LD<&CPU::x, ZPY>) \
+    OP(0xae, 2, false, LD<&CPU::x, ABS>) OP(0xbe, 2, false, LD<&CPU::x, ABY>) \
+    /* LDY */ \
+    OP(0xa0, 1, false, LD<&CPU::y, IMM>) OP(0xa4, 1, false, LD<&CPU::y, ZP>)  OP(0xb4, 1, false, LD<&CPU::y, ZPX>) \
+    OP(0xac, 2, false, LD<&CPU::y, ABS>) OP(0xbc, 2, false, LD<&CPU::y, ABX>) \
+    /* LSR */ \
+    OP(0x4a, 0, false, LSR_A)    OP(0x46, 1, false, LSR<ZP>)  OP(0x56, 1, false, LSR<ZPX>) OP(0x4e, 2, false, LSR<ABS>) \
+    OP(0x5e, 2, false, LSR<ABX>) \
+    /* NOP */ \
+    OP(0xea, 0, false, NOP) OP(0x42, 1, false, NOP) \
+    /* ORA */ \
+    OP(0x09, 1, false, ORA<IMM>) OP(0x05, 1, false, ORA<ZP>)  OP(0x15, 1, false, ORA<ZPX>) OP(0x0d, 2, false, ORA<ABS>) \
+    OP(0x1d, 2, false, ORA<ABX>) OP(0x19, 2, false, ORA<ABY>) OP(0x01, 1, false, ORA<IZX>) OP(0x11, 1, false, ORA<IZY>) \
+    /* Stack */ \
+    OP(0x48, 0, false, PHA) OP(0x08, 0, false, PHP) OP(0x68, 0, false, PLA) OP(0x28, 0, false, PLP) \
+    /* ROL */ \
+    OP(0x2a, 0, false, ROL_A)    OP(0x26, 1, false, ROL<ZP>)  OP(0x36, 1, false, ROL<ZPX>) OP(0x2e, 2, false, ROL<ABS>) \
+    OP(0x3e, 2, false, ROL<ABX>) \
+    /* ROR */ \
+    OP(0x6a, 0, false, ROR_A)    OP(0x66, 1, false, ROR<ZP>)  OP(0x76, 1, false, ROR<ZPX>) OP(0x6e, 2, false, ROR<ABS>) \
+    OP(0x7e, 2, false, ROR<ABX>) \
+    /* RTI, RTS */ \
+    OP(0x40, 0, true, RTI) OP(0x60, 0, true, RTS) \
+    /* SBC */ \
+    OP(0xe9, 1, false, SBC<IMM>) OP(0xe5, 1, false, SBC<ZP>)  OP(0xf5, 1, false, SBC<ZPX>) OP(0xed, 2, false, SBC<ABS>) \
+    OP(0xfd, 2, false, SBC<ABX>) OP(0xf9, 2, false, SBC<ABY>) OP(0xe1, 1, false, SBC<IZX>) OP(0xf1, 1, false, SBC<IZY>) \
+    /* STA */ \
+    OP(0x85, 1, false, ST<&CPU::a, ZP>)  OP(0x95, 1, false, ST<&CPU::a, ZPX>) OP(0x8d, 2, false, ST<&CPU::a, ABS>) \
+    OP(0x9d, 2, false, ST<&CPU::a, ABX>) OP(0x99, 2, false, ST<&CPU::a, ABY>) OP(0x81, 1, false, ST<&CPU::a, IZX>) \
+    OP(0x91, 1, false, ST<&CPU::a, IZY>) \
+    /* STX, STY */ \
+    OP(0x86, 1, false, ST<&CPU::x, ZP>)  OP(0x96, 1, false, ST<&CPU::x, ZPY>) OP(0x8e, 2, false, ST<&CPU::x, ABS>) \
+    OP(0x84, 1, false, ST<&CPU::y, ZP>)  OP(0x94, 1, false, ST<&CPU::y, ZPX>) OP(0x8c, 2, false, ST<&CPU::y, ABS>) \
+    /* Transfers */ \
+    OP(0xaa, 0, false, TAX) OP(0xa8, 0, false, TAY) OP(0xba, 0, false, TSX) \
+    OP(0x8a, 0, false, TXA) OP(0x9a, 0, false, TXS) OP(0x98, 0, false, TYA)
+
+constexpr std::array<Instruction, 256> buildInstructions() {
+
+    std::array<Instruction, 256> table {};
+
+    // Unknown opcodes stop blocks so they are reported at the right PC
+    for(int i = 0 ; i < 256 ; i++)
+        table[i] = { UNK, fetchAndExecute<0, UNK>, 0, true };
+
+#define OP(opcode, size, ends, ...) \
+    table[opcode] = { __VA_ARGS__, fetchAndExecute<size, __VA_ARGS__>, size, ends };
+
+    OPCODES(OP)
+
+#undef OP
+
+    return table;
+}
+
+}
+
+// Built at compile time
+const std::array<Instruction, 256> instructions = buildInstructions();
@@ -0,0 +1,26 @@
+#ifndef CPU_DISPATCH_HPP
+#define CPU_DISPATCH_HPP
+
+#include <array>
+#include "cpu.hpp"
+
+// Instruction handler
+// Runs one instruction. The opcode and operand bytes have already been
+// fetched and PC points to the next instruction.
+typedef void (*InstructionHandler)(CPU* cpu, word operand);
+
+// Opcode handler
+// Fetches the operand bytes at PC, then runs the instruction
+typedef void (*OpcodeHandler)(CPU* cpu);
+
+struct Instruction {
+    InstructionHandler execute;
+    OpcodeHandler dispatch;
+    byte operandSize;       // Number of operand bytes (0, 1 or 2)
+    bool endsBlock;         // Changes the control flow
+};
+
+// Handlers for each opcode, with the addressing mode resolved at compile time
+extern const std::array<Instruction, 256> instructions;
+
+#endif
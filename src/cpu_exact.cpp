@@ -0,0 +1,428 @@
+#include "cpu.hpp"
+#include "log.hpp"
+#include <iostream>
+#include <iomanip>
+
+// Cycle-exact execution
+// Each bus access advances the cycle counters by one, so soft switches and
+// devices see every access, dummy ones included, at the cycle a 6502 makes it.
+
+// Bus access
+
+inline byte CPU::busRead(word addr) {
+    byte value = mem->readByte(addr);
+    decrementCycles(1);
+    return value;
+}
+
+inline void CPU::busWrite(word addr, byte value) {
+    mem->writeByte(addr, value);
+    decrementCycles(1);
+}
+
+// Dummy read of the byte after a single byte instruction
+inline void CPU::busIdle() { busRead(pc); }
+
+inline void CPU::busPush(byte value) {
+    busWrite(MOS6505_STACK + sp, value);
+    sp --;
+}
+
+inline byte CPU::busPull() {
+    sp ++;
+    return busRead(MOS6505_STACK + sp);
+}
+
+// Addressing modes
+
+// Zero-page
+inline word CPU::exactZeropage() { return busRead(pc++); }
+
+// Indexed zero-page, the base address is read while the index is added
+inline word CPU::exactZeropageIndexed(byte index) {
+    byte base = busRead(pc++);
+    busRead(base);
+
+    return (byte)(base + index);
+}
+
+// Absolute
+inline word CPU::exactAbsolute() {
+    word addr = busRead(pc++);
+    addr |= busRead(pc++) << 8;
+
+    return addr;
+}
+
+// Indexed absolute
+// The high byte is fixed one cycle late, so there is a read from the base page
+// first. Reads skip it when no page is crossed, writes never do.
+inline word CPU::exactAbsoluteIndexed(byte index, bool write) {
+    word base = exactAbsolute();
+    word addr = base + index;
+
+    if(write || checkPageCrossed(base, index))
+        busRead((base & 0xff00) | (addr & 0xff));
+
+    return addr;
+}
+
+// Indexed indirect, the pointer wraps around the zero page
+inline word CPU::exactIndexedIndirect() {
+    byte pointer = busRead(pc++);
+    busRead(pointer);
+    pointer += x;
+
+    word addr = busRead(pointer);
+    addr |= busRead((byte)(pointer + 1)) << 8;
+
+    return addr;
+}
+
+// Indirect indexed, same page fix as indexed absolute
+inline word CPU::exactIndirectIndexed(bool write) {
+    byte pointer = busRead(pc++);
+
+    word base = busRead(pointer);
+    base |= busRead((byte)(pointer + 1)) << 8;
+
+    word addr = base + y;
+
+    if(write || checkPageCrossed(base, y))
+        busRead((base & 0xff00) | (addr & 0xff));
+
+    return addr;
+}
+
+// Read-modify-write : read, write back the unmodified value, write the result
+template<void (CPU::*op)(byte*)>
+inline void CPU::exactModify(word addr) {
+    byte value = busRead(addr);
+    busWrite(addr, value);
+
+    (this->*op)(&value);
+
+    busWrite(addr, value);
+}
+
+// Conditional branch
+// A taken branch reads the next opcode while adding the offset,
+// and reads from the old page if the target is on another one
+void CPU::exactBranch(bool taken) {
+    signed_byte offset = busRead(pc++);
+
+    if(!taken)
+        return;
+
+    busRead(pc);
+
+    word target = pc + offset;
+
+    if(checkPageCrossed(pc, offset))
+        busRead((pc & 0xff00) | (target & 0xff));
+
+    pc = target;
+}
+
+// IRQ, NMI and BRK
+void CPU::exactInterrupt(word vector, bool brk) {
+    if(brk) {
+        busRead(pc++);      // Padding byte after BRK
+    }
+    else {
+        busIdle();
+        busIdle();
+    }
+
+    busPush(pc >> 8);
+    busPush(pc & 0xff);
+
+    setBreak(brk);
+    busPush(getFlagRegister());
+    setInterrupt(true);
+
+    word target = busRead(vector);
+    target |= busRead(vector + 1) << 8;
+    pc = target;
+}
+
+// Emulate the next CPU instruction, one bus access per cycle
+void CPU::emulateInstructionExact() {
+
+    // NMI pending
+    if(pendingNMI) {
+        pendingNMI = false;
+        exactInterrupt(MOS6502_NMI, false);
+        return;
+    }
+
+    // IRQ pending
+    if(pendingIRQ) {
+        pendingIRQ = false;
+        exactInterrupt(MOS6502_IRQ_BRK, false);
+        return;
+    }
+
+    if(debug)
+        printOpcode(pc);
+
+    // Fetch opcode
+    byte opcode = busRead(pc++);
+
+    currentOpcode = opcode;
+
+    switch(opcode) {
+
+        // ADC
+        case 0x69: adc(busRead(pc++)); break;                                               //ADC #d8
+        case 0x65: adc(busRead(exactZeropage())); break;                                    //ADC a8
+        case 0x75: adc(busRead(exactZeropageIndexed(x))); break;                            //ADC a8,X
+        case 0x6d: adc(busRead(exactAbsolute())); break;                                    //ADC a16
+        case 0x7d: adc(busRead(exactAbsoluteIndexed(x, false))); break;                     //ADC a16,X
+        case 0x79: adc(busRead(exactAbsoluteIndexed(y, false))); break;                     //ADC a16,Y
+        case 0x61: adc(busRead(exactIndexedIndirect())); break;                             //ADC (a8,X)
+        case 0x71: adc(busRead(exactIndirectIndexed(false))); break;                        //ADC (a8),Y
+
+        // AND
+        case 0x29: and_(busRead(pc++)); break;                                              //AND #d8
+        case 0x25: and_(busRead(exactZeropage())); break;                                   //AND a8
+        case 0x35: and_(busRead(exactZeropageIndexed(x))); break;                           //AND a8,X
+        case 0x2d: and_(busRead(exactAbsolute())); break;                                   //AND a16
+        case 0x3d: and_(busRead(exactAbsoluteIndexed(x, false))); break;                    //AND a16,X
+        case 0x39: and_(busRead(exactAbsoluteIndexed(y, false))); break;                    //AND a16,Y
+        case 0x21: and_(busRead(exactIndexedIndirect())); break;                            //AND (a8,X)
+        case 0x31: and_(busRead(exactIndirectIndexed(false))); break;                       //AND (a8),Y
+
+        // ASL
+        case 0x0a: busIdle(); asl(&a); break;                                               //ASL a
+        case 0x06: exactModify<&CPU::asl>(exactZeropage()); break;                          //ASL a8
+        case 0x16: exactModify<&CPU::asl>(exactZeropageIndexed(x)); break;                  //ASL a8,X
+        case 0x0e: exactModify<&CPU::asl>(exactAbsolute()); break;                          //ASL a16
+        case 0x1e: exactModify<&CPU::asl>(exactAbsoluteIndexed(x, true)); break;            //ASL a16,X
+
+        // BIT
+        case 0x24: bit(busRead(exactZeropage())); break;                                    //BIT a8
+        case 0x2c: bit(busRead(exactAbsolute())); break;                                    //BIT a16
+
+        // Branches
+        case 0x90: exactBranch(!carry()); break;                                            //BCC
+        case 0xb0: exactBranch(carry()); break;                                             //BCS
+        case 0xf0: exactBranch(zero()); break;                                              //BEQ
+        case 0x30: exactBranch(negative()); break;                                          //BMI
+        case 0xd0: exactBranch(!zero()); break;                                             //BNE
+        case 0x10: exactBranch(!negative()); break;                                         //BPL
+        case 0x50: exactBranch(!overflow()); break;                                         //BVC
+        case 0x70: exactBranch(overflow()); break;                                          //BVS
+
+        // BRK
+        case 0x00: exactInterrupt(MOS6502_IRQ_BRK, true); break;                            //BRK
+
+        // Clear flags
+        case 0x18: busIdle(); setCarry(false); break;                                       //CLC
+        case 0xd8: busIdle(); setDecimal(false); break;                                     //CLD
+        case 0x58: busIdle(); setInterrupt(false); break;                                   //CLI
+        case 0xb8: busIdle(); setOverflow(false); break;                                    //CLV
+
+        // CMP
+        case 0xc9: cmp(a, busRead(pc++)); break;                                            //CMP #d8
+        case 0xc5: cmp(a, busRead(exactZeropage())); break;                                 //CMP a8
+        case 0xd5: cmp(a, busRead(exactZeropageIndexed(x))); break;                         //CMP a8,X
+        case 0xcd: cmp(a, busRead(exactAbsolute())); break;                                 //CMP a16
+        case 0xdd: cmp(a, busRead(exactAbsoluteIndexed(x, false))); break;                  //CMP a16,X
+        case 0xd9: cmp(a, busRead(exactAbsoluteIndexed(y, false))); break;                  //CMP a16,Y
+        case 0xc1: cmp(a, busRead(exactIndexedIndirect())); break;                          //CMP (a8,X)
+        case 0xd1: cmp(a, busRead(exactIndirectIndexed(false))); break;                     //CMP (a8),Y
+
+        // CPX
+        case 0xe0: cmp(x, busRead(pc++)); break;                                            //CPX #d8
+        case 0xe4: cmp(x, busRead(exactZeropage())); break;                                 //CPX a8
+        case 0xec: cmp(x, busRead(exactAbsolute())); break;                                 //CPX a16
+
+        // CPY
+        case 0xc0: cmp(y, busRead(pc++)); break;                                            //CPY #d8
+        case 0xc4: cmp(y, busRead(exactZeropage())); break;                                 //CPY a8
+        case 0xcc: cmp(y, busRead(exactAbsolute())); break;                                 //CPY a16
+
+        // DEC
+        case 0xc6: exactModify<&CPU::dec>(exactZeropage()); break;                          //DEC a8
+        case 0xd6: exactModify<&CPU::dec>(exactZeropageIndexed(x)); break;                  //DEC a8,X
+        case 0xce: exactModify<&CPU::dec>(exactAbsolute()); break;                          //DEC a16
+        case 0xde: exactModify<&CPU::dec>(exactAbsoluteIndexed(x, true)); break;            //DEC a16,X
+        case 0xca: busIdle(); dec(&x); break;                                               //DEX
+        case 0x88: busIdle(); dec(&y); break;                                               //DEY
+
+        // EOR
+        case 0x49: eor(busRead(pc++)); break;                                               //EOR #d8
+        case 0x45: eor(busRead(exactZeropage())); break;                                    //EOR a8
+        case 0x55: eor(busRead(exactZeropageIndexed(x))); break;                            //EOR a8,X
+        case 0x4d: eor(busRead(exactAbsolute())); break;                                    //EOR a16
+        case 0x5d: eor(busRead(exactAbsoluteIndexed(x, false))); break;                     //EOR a16,X
+        case 0x59: eor(busRead(exactAbsoluteIndexed(y, false))); break;                     //EOR a16,Y
+        case 0x41: eor(busRead(exactIndexedIndirect())); break;                             //EOR (a8,X)
+        case 0x51: eor(busRead(exactIndirectIndexed(false))); break;                        //EOR (a8),Y
+
+        // INC
+        case 0xe6: exactModify<&CPU::inc>(exactZeropage()); break;                          //INC a8
+        case 0xf6: exactModify<&CPU::inc>(exactZeropageIndexed(x)); break;                  //INC a8,X
+        case 0xee: exactModify<&CPU::inc>(exactAbsolute()); break;                          //INC a16
+        case 0xfe: exactModify<&CPU::inc>(exactAbsoluteIndexed(x, true)); break;            //INC a16,X
+        case 0xe8: busIdle(); inc(&x); break;                                               //INX
+        case 0xc8: busIdle(); inc(&y); break;                                               //INY
+
+        // JMP
+        case 0x4c: pc = exactAbsolute(); break;                                             //JMP a16
+        case 0x6c: {
+            // The pointer high byte is read from the same page
+            word pointer = exactAbsolute();
+            word target = busRead(pointer);
+            target |= busRead((pointer & 0xff00) | ((pointer + 1) & 0xff)) << 8;
+            pc = target;
+            break;
+        }
+
+        // JSR
+        case 0x20: {
+            word target = busRead(pc++);
+            busRead(MOS6505_STACK + sp);
+            busPush(pc >> 8);
+            busPush(pc & 0xff);
+            target |= busRead(pc) << 8;
+            pc = target;
+            break;
+        }
+
+        // LDA
+        case 0xa9: ld(&a, busRead(pc++)); break;                                            //LDA #d8
+        case 0xa5: ld(&a, busRead(exactZeropage())); break;                                 //LDA a8
+        case 0xb5: ld(&a, busRead(exactZeropageIndexed(x))); break;                         //LDA a8,X
+        case 0xad: ld(&a, busRead(exactAbsolute())); break;                                 //LDA a16
+        case 0xbd: ld(&a, busRead(exactAbsoluteIndexed(x, false))); break;                  //LDA a16,X
+        case 0xb9: ld(&a, busRead(exactAbsoluteIndexed(y, false))); break;                  //LDA a16,Y
+        case 0xa1: ld(&a, busRead(exactIndexedIndirect())); break;                          //LDA (a8,X)
+        case 0xb1: ld(&a, busRead(exactIndirectIndexed(false))); break;                     //LDA (a8),Y
+
+        // LDX
+        case 0xa2: ld(&x, busRead(pc++)); break;                                            //LDX #d8
+        case 0xa6: ld(&x, busRead(exactZeropage())); break;                                 //LDX a8
+        case 0xb6: ld(&x, busRead(exactZeropageIndexed(y))); break;                         //LDX a8,Y
+        case 0xae: ld(&x, busRead(exactAbsolute())); break;                                 //LDX a16
+        case 0xbe: ld(&x, busRead(exactAbsoluteIndexed(y, false))); break;                  //LDX a16,Y
+
+        // LDY
+        case 0xa0: ld(&y, busRead(pc++)); break;                                            //LDY #d8
+        case 0xa4: ld(&y, busRead(exactZeropage())); break;                                 //LDY a8
+        case 0xb4: ld(&y, busRead(exactZeropageIndexed(x))); break;                         //LDY a8,X
+        case 0xac: ld(&y, busRead(exactAbsolute())); break;                                 //LDY a16
+        case 0xbc: ld(&y, busRead(exactAbsoluteIndexed(x, false))); break;                  //LDY a16,X
+
+        // LSR
+        case 0x4a: busIdle(); lsr(&a); break;                                               //LSR a
+        case 0x46: exactModify<&CPU::lsr>(exactZeropage()); break;                          //LSR a8
+        case 0x56: exactModify<&CPU::lsr>(exactZeropageIndexed(x)); break;                  //LSR a8,X
+        case 0x4e: exactModify<&CPU::lsr>(exactAbsolute()); break;                          //LSR a16
+        case 0x5e: exactModify<&CPU::lsr>(exactAbsoluteIndexed(x, true)); break;            //LSR a16,X
+
+        // NOP
+        case 0xea: busIdle(); break;                                                        //NOP
+        case 0x42: busRead(pc++); break;                                                    //NOP imm (65C02)
+
+        // ORA
+        case 0x09: ora(busRead(pc++)); break;                                               //ORA #d8
+        case 0x05: ora(busRead(exactZeropage())); break;                                    //ORA a8
+        case 0x15: ora(busRead(exactZeropageIndexed(x))); break;                            //ORA a8,X
+        case 0x0d: ora(busRead(exactAbsolute())); break;                                    //ORA a16
+        case 0x1d: ora(busRead(exactAbsoluteIndexed(x, false))); break;                     //ORA a16,X
+        case 0x19: ora(busRead(exactAbsoluteIndexed(y, false))); break;                     //ORA a16,Y
+        case 0x01: ora(busRead(exactIndexedIndirect())); break;                             //ORA (a8,X)
+        case 0x11: ora(busRead(exactIndirectIndexed(false))); break;                        //ORA (a8),Y
+
+        // Stack
+        case 0x48: busIdle(); busPush(a); break;                                            //PHA
+        case 0x08: busIdle(); setBreak(true); busPush(getFlagRegister()); break;            //PHP
+        case 0x68: busIdle(); busRead(MOS6505_STACK + sp); a = busPull(); setAccNZ(); break;//PLA
+        case 0x28: busIdle(); busRead(MOS6505_STACK + sp); setFlagRegister(busPull()); break;//PLP
+
+        // ROL
+        case 0x2a: busIdle(); rol(&a); break;                                               //ROL a
+        case 0x26: exactModify<&CPU::rol>(exactZeropage()); break;                          //ROL a8
+        case 0x36: exactModify<&CPU::rol>(exactZeropageIndexed(x)); break;                  //ROL a8,X
+        case 0x2e: exactModify<&CPU::rol>(exactAbsolute()); break;                          //ROL a16
+        case 0x3e: exactModify<&CPU::rol>(exactAbsoluteIndexed(x, true)); break;            //ROL a16,X
+
+        // ROR
+        case 0x6a: busIdle(); ror(&a); break;                                               //ROR a
+        case 0x66: exactModify<&CPU::ror>(exactZeropage()); break;                          //ROR a8
+        case 0x76: exactModify<&CPU::ror>(exactZeropageIndexed(x)); break;                  //ROR a8,X
+        case 0x6e: exactModify<&CPU::ror>(exactAbsolute()); break;                          //ROR a16
+        case 0x7e: exactModify<&CPU::ror>(exactAbsoluteIndexed(x, true)); break;            //ROR a16,X
+
+        // RTI
+        case 0x40: {
+            busIdle();
+            busRead(MOS6505_STACK + sp);
+            setFlagRegister(busPull());
+            word target = busPull();
+            target |= busPull() << 8;
+            pc = target;
+            break;
+        }
+
+        // RTS
+        case 0x60: {
+            busIdle();
+            busRead(MOS6505_STACK + sp);
+            word target = busPull();
+            target |= busPull() << 8;
+            busRead(target);
+            pc = target + 1;
+            break;
+        }
+
+        // SBC
+        case 0xe9: sbc(busRead(pc++)); break;                                               //SBC #d8
+        case 0xe5: sbc(busRead(exactZeropage())); break;                                    //SBC a8
+        case 0xf5: sbc(busRead(exactZeropageIndexed(x))); break;                            //SBC a8,X
+        case 0xed: sbc(busRead(exactAbsolute())); break;                                    //SBC a16
+        case 0xfd: sbc(busRead(exactAbsoluteIndexed(x, false))); break;                     //SBC a16,X
+        case 0xf9: sbc(busRead(exactAbsoluteIndexed(y, false))); break;                     //SBC a16,Y
+        case 0xe1: sbc(busRead(exactIndexedIndirect())); break;                             //SBC (a8,X)
+        case 0xf1: sbc(busRead(exactIndirectIndexed(false))); break;                        //SBC (a8),Y
+
+        // Set flags
+        case 0x38: busIdle(); setCarry(true); break;                                        //SEC
+        case 0xf8: busIdle(); setDecimal(true); break;                                      //SED
+        case 0x78: busIdle(); setInterrupt(true); break;                                    //SEI
+
+        // STA
+        case 0x85: busWrite(exactZeropage(), a); break;                                     //STA a8
+        case 0x95: busWrite(exactZeropageIndexed(x), a); break;                             //STA a8,X
+        case 0x8d: busWrite(exactAbsolute(), a); break;                                     //STA a16
+        case 0x9d: busWrite(exactAbsoluteIndexed(x, true), a); break;                       //STA a16,X
+        case 0x99: busWrite(exactAbsoluteIndexed(y, true), a); break;                       //STA a16,Y
+        case 0x81: busWrite(exactIndexedIndirect(), a); break;                              //STA (a8,X)
+        case 0x91: busWrite(exactIndirectIndexed(true), a); break;                          //STA (a8),Y
+
+        // STX
+        case 0x86: busWrite(exactZeropage(), x); break;                                     //STX a8
+        case 0x96: busWrite(exactZeropageIndexed(y), x); break;                             //STX a8,Y
+        case 0x8e: busWrite(exactAbsolute(), x); break;                                     //STX a16
+
+        // STY
+        case 0x84: busWrite(exactZeropage(), y); break;                                     //STY a8
+        case 0x94: busWrite(exactZeropageIndexed(x), y); break;                             //STY a8,X
+        case 0x8c: busWrite(exactAbsolute(), y); break;                                     //STY a16
+
+        // Transfers
+        case 0xaa: busIdle(); x = a; setAccNZ(); break;                                     //TAX
+        case 0xa8: busIdle(); y = a; setAccNZ(); break;                                     //TAY
+        case 0xba: busIdle(); x = sp; setNZ(x); break;                                      //TSX
+        case 0x8a: busIdle(); a = x; setAccNZ(); break;                                     //TXA
+        case 0x9a: busIdle(); sp = x; break;                                                //TXS
+        case 0x98: busIdle(); a = y; setAccNZ(); break;                                     //TYA
+
+        // Unknown opcode
+        default :
+            busIdle();
+            LOG("Unknown opcode: " << std::hex << std::setw(2) << (int)opcode << " at pc " << std::setw(4) << (int) pc);
+    }
+}
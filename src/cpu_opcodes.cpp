@@ -5,7 +5,7 @@
 // Interrupt requests
 
 void CPU::requestIRQ() {
-    if(!i) {
+    if(!interrupt()) {
         pendingIRQ = true;
     }
 }
@@ -46,15 +46,15 @@ void CPU::adc(byte operand) {
 
     byte acc = a;
     
-    if(d) {
+    if(decimal()) {
         //BCD mode
         operand = binaryToDecimal(operand);
         acc = binaryToDecimal(a);
     }
     
-    uint32 result = acc + operand + c;
+    uint32 result = acc + operand + carry();
 
-    if(d) {
+    if(decimal()) {
         //Overflow flag not affected in decimal mode
         setCarry(result > 99);
 
@@ -65,7 +65,7 @@ void CPU::adc(byte operand) {
         a = decimalToBinary(result);
     }
     else {
-        int signedResult = (signed char)acc + (signed char)operand + c;
+        int signedResult = (signed char)acc + (signed char)operand + carry();
 
         setOverflow((signedResult > 127 || signedResult < -128));
         setCarry(result > 0xff);
@@ -94,7 +94,10 @@ void CPU::branch(signed_byte offset) {
 }
 
 void CPU::condBranch(byte flag) {
-    signed_byte offset = nextByte();
+    condBranch(flag, nextByte());
+}
+
+void CPU::condBranch(byte flag, signed_byte offset) {
 
     if(flag) {
         decrementCycles(1);     // 1 extra cycle if branch is taken
@@ -108,11 +111,10 @@ void CPU::condBranch(byte flag) {
 
 
 void CPU::bit(byte operand) {
-    byte result = a & operand;
+    nResult = operand;
+    zResult = a & operand;
 
-    setNegative((operand >> 7) != 0);
-    setOverflow(((operand & 0x40) >> 6) != 0);
-    setZero((result == 0));
+    setOverflow(operand & FLAG_V);
 }
 
 void CPU::brk() {
@@ -125,12 +127,8 @@ void CPU::brk() {
 }
 
 void CPU::cmp(byte reg, byte operand) {
-    byte result = reg - operand;
-
     setCarry(reg >= operand);
-    setZero(reg == operand);
-
-    setNegative(result & 0x80);
+    setNZ(reg - operand);
 }
 
 void CPU::dec(byte* addr) {
@@ -180,7 +178,7 @@ void CPU::ora(byte operand) {
 }
 
 void CPU::rol(byte* operandAddr) {
-    byte carry = c;
+    byte carry = this->carry();
 
     setCarry((*operandAddr) >> 7);
 
@@ -190,7 +188,7 @@ void CPU::rol(byte* operandAddr) {
 }
 
 void CPU::ror(byte* operandAddr) {
-    byte carry = c;
+    byte carry = this->carry();
 
     setCarry((*operandAddr) & 0x01);
 
@@ -209,13 +207,13 @@ void CPU::rts() {
 }
 
 void CPU::sbc(byte operand) {
-    if(!d)
+    if(!decimal())
         adc(~operand);
     else {
         operand = binaryToDecimal(operand);
         byte acc = binaryToDecimal(a);
 
-        int result = acc - operand - (1 - c);
+        int result = acc - operand - (1 - carry());
 
         setCarry(result >= 0);
 
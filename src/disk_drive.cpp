@@ -1,42 +1,236 @@
 #include "disk_drive.hpp"
 #include "disk_images.hpp"
 #include <iostream>
+#include <cstring>
 
 #define DISK_LOG 0
 
-Disk::Disk() {
+Drive::Drive() {
 
+    track = 0;
     motorPhase = 0;
+
+    spinning = false;
+    lastCycle = 0;
+    spinCycles = 0;
+
+    shiftRegister = 0;
+    latchAge = Disk::LATCH_HOLD_BITS;
+    bitsRead = 0;
+
+    releaseEvent = 0;
+
+    diskImage = new DiskImage();
+
+    for(int i = 0 ; i < TRACKS ; i++) {
+        nibbles[i] = nullptr;
+        dirty[i] = false;
+    }
+}
+
+Drive::~Drive() {
+    clearTracks();
+    delete diskImage;
+}
+
+int Drive::loadFile(std::string filename, bool writeBack) {
+    clearTracks();
+    return diskImage->loadFile(filename, writeBack);
+}
+
+const byte* Drive::trackNibbles(int track) {
+
+    // Stored nibblized, nothing to encode
+    if(diskImage->format == DiskImage::FORMAT_NIB)
+        return diskImage->diskFile + track * NIBBLES_PER_TRACK;
+
+    if(nibbles[track])
+        return nibbles[track];
+
+    if(!sharedTracks[track])
+        sharedTracks[track] = NibbleCache::shared().get(diskImage->diskFile + diskAddr(track, 0), track, diskImage->dosOrder());
+
+    return sharedTracks[track]->nibbles;
+}
+
+byte* Drive::writableTrack(int track) {
+
+    // Written in place in the private view of the file
+    if(diskImage->format == DiskImage::FORMAT_NIB)
+        return diskImage->diskFile + track * NIBBLES_PER_TRACK;
+
+    if(!nibbles[track]) {
+        const byte* source = trackNibbles(track);
+
+        nibbles[track] = new byte[NIBBLES_PER_TRACK];
+        memcpy(nibbles[track], source, NIBBLES_PER_TRACK);
+        sharedTracks[track].reset();
+    }
+
+    return nibbles[track];
+}
+
+void Drive::flush() {
+    for(int i = 0 ; i < TRACKS ; i++) {
+        if(!dirty[i])
+            continue;
+
+        dirty[i] = false;
+
+        // Nibble images are written back as they are
+        if(diskImage->format == DiskImage::FORMAT_NIB) {
+            for(int offset = 0 ; offset < NIBBLES_PER_TRACK ; offset += 256)
+                diskImage->writeSector(i * NIBBLES_PER_TRACK + offset);
+
+            continue;
+        }
+
+        // Sectors that do not decode keep their previous content
+        byte sectors[16 * 256];
+        byte* image = diskImage->diskFile + diskAddr(i, 0);
+
+        memcpy(sectors, image, sizeof(sectors));
+        decodeNibbles(nibbles[i], NIBBLES_PER_TRACK, sectors, diskImage->dosOrder());
+
+        for(int s = 0 ; s < 16 ; s++) {
+            if(memcmp(image + s * 256, sectors + s * 256, 256) != 0) {
+                memcpy(image + s * 256, sectors + s * 256, 256);
+                diskImage->writeSector(diskAddr(i, s));
+            }
+        }
+    }
+}
+
+void Drive::clearTracks() {
+    flush();
+
+    for(int i = 0 ; i < TRACKS ; i++) {
+        delete[] nibbles[i];
+        nibbles[i] = nullptr;
+        sharedTracks[i].reset();
+    }
+}
+
+void Drive::spin(uint64 now) {
+    if(spinning)
+        spinCycles += now - lastCycle;
+
+    lastCycle = now;
+}
+
+Disk::Disk() {
+
     magnet[0] = false;
     magnet[1] = false;
     magnet[2] = false;
     magnet[3] = false;
 
-    driveOn[0] = false;
-    driveOn[1] = false;
+    writeMode = false;
+    loadMode = false;
 
-    sector = 0;
-    byteCount = 0;
-    track = 0;
+    currentDrive = 0;
+    motorEnabled = false;
+
+    releaseDelay = 10 * MOTOR_OFF_DELAY;
+
+    motorOffEvent = 0;
+
+    latch = 0;
+
+    fastMode = false;
+}
+
+Disk::~Disk() {
+}
+
+int Disk::loadFile(std::string filename, bool writeBack, int drive) {
+    return drives[drive].loadFile(filename, writeBack);
+}
+
+// Without a disk, the autostart ROM finds no controller to boot from
+const byte* Disk::slotRom() {
+    return (loaded(0) || loaded(1)) ? bootstrapROM : nullptr;
+}
+
+void Disk::reset() {
+
+    // Pending events were dropped with the scheduler ones
+    motorOffEvent = 0;
+    motorEnabled = false;
+
+    for(int i = 0 ; i < 2 ; i++) {
+        drives[i].releaseEvent = 0;
+        stopDrive(i);
+    }
+
+    for(int i = 0 ; i < 4 ; i++)
+        magnet[i] = false;
 
     writeMode = false;
+    loadMode = false;
+    currentDrive = 0;
+}
 
-    spinning = 0;
+void Disk::detach() {
 
-    diskImage = new DiskImage();
+    // The event handlers point to this controller and its drives
+    if(motorOffEvent) {
+        scheduler->cancel(motorOffEvent);
+        motorOffEvent = 0;
+    }
+
+    for(int i = 0 ; i < 2 ; i++) {
+        if(drives[i].releaseEvent) {
+            scheduler->cancel(drives[i].releaseEvent);
+            drives[i].releaseEvent = 0;
+        }
+    }
+}
+
+void Disk::startDrive(int drive) {
+    Drive& d = drives[drive];
 
-    encoded = false;
+    if(d.releaseEvent) {
+        scheduler->cancel(d.releaseEvent);
+        d.releaseEvent = 0;
+    }
+
+    if(d.spinning)
+        return;
+
+    d.spin(now());
+    d.spinning = true;
 }
 
-int Disk::loadFile(std::string filename) {
-    encoded = false;
-    return diskImage->loadFile(filename);
+void Disk::stopDrive(int drive) {
+    Drive& d = drives[drive];
+
+    if(!d.spinning)
+        return;
+
+    d.spin(now());
+    d.spinning = false;
+
+    // Sectors written so far reach the image
+    d.flush();
+
+    // Idle drives give their encoded tracks back
+    if(scheduler && !d.releaseEvent) {
+        d.releaseEvent = scheduler->schedule(now() + releaseDelay, [&d](uint64) {
+            d.releaseEvent = 0;
+            d.clearTracks();
+        });
+    }
 }
 
 byte Disk::setPhase(byte phase, bool on, word addr) {
 
     magnet[phase % 4] = on;
 
+    // Only the selected drive steps
+    Drive& d = drives[currentDrive];
+    int motorPhase = d.motorPhase;
+
     int direction = 0;
 
     // Will the stepper motor move ?
@@ -49,55 +243,172 @@ byte Disk::setPhase(byte phase, bool on, word addr) {
     }
 
     // Apply motor movement
-    motorPhase = MIN(70, MAX(0, (motorPhase + direction)));
+    d.motorPhase = MIN(70, MAX(0, (motorPhase + direction)));
     
-    track = motorPhase >> 1;
+    d.track = d.motorPhase >> 1;
 
     // TODO return random if addr != 0xe0
     return (addr == 0xe0) ? 0xff : 0x00;
 }
 
-void Disk::encodeAll() {
-    for (int diskTrack = 0 ; diskTrack < 35 ; diskTrack ++ ) {
-        encodeNibbles(diskImage->diskFile + diskAddr(diskTrack, 0), nibbles[diskTrack], true, diskTrack);
-    }
+uint64 Disk::bitClock(Drive& drive) {
+    drive.spin(now());
 
-    encoded = true;
+    // WOZ bit timing is in 1/8 microseconds, about 1/8 CPU cycle
+    if(drive.diskImage->woz)
+        return drive.spinCycles * 8 / drive.diskImage->woz->bitTiming;
+
+    return drive.spinCycles / CYCLES_PER_BIT;
 }
 
 byte Disk::readWriteData() {
-    
-    if(currentDrive == 0 && !writeMode) {
 
-        // Encode (nibblize) disk data
-        if(!encoded) {
-            encodeAll();
+    loadMode = false;
+
+    Drive& drive = drives[currentDrive];
+
+    if(drive.diskImage->loaded) {
+
+        if(writeMode)
+            return writeNibble(drive);
+
+        return drive.diskImage->woz ? readBits(drive) : readNibble(drive);
+    }
+
+    return 0;
+}
+
+// Between fields, rather than inside one
+// $FF and $DE are valid bytes in data fields, but $D5 (prologue) never is,
+// nor is the epilogue pair $DE $AA : $AA is not a 6-and-2 byte, and $DE is not
+// a 4-and-4 address byte. The last one of the two before position tells.
+static bool inGap(const byte* data, int position) {
+    for(int i = 1 ; i < NIBBLES_PER_TRACK ; i++) {
+        int p = (position + NIBBLES_PER_TRACK - i) % NIBBLES_PER_TRACK;
+
+        if(data[p] == 0xd5)
+            return false;
+
+        if(data[p] == 0xaa && data[(p + NIBBLES_PER_TRACK - 1) % NIBBLES_PER_TRACK] == 0xde)
+            return true;
+    }
+
+    return true;
+}
+
+// Latch of a nibblized track, every disk byte is 8 bit cells long
+// The previous byte is held for LATCH_HOLD_BITS cells, then the bits of the
+// current one shift in with bit 7 clear
+byte Disk::readNibble(Drive& drive) {
+    const byte* data = drive.trackNibbles(drive.track);
+
+    uint64 bit = bitClock(drive) % (NIBBLES_PER_TRACK * 8);
+    int position = bit / 8;
+    int shifted = bit % 8;
+
+    // Fast disk : turn the disk until the byte being read is complete,
+    // past the self-sync bytes software reads while looking for a prologue
+    if(fastMode && shifted >= LATCH_HOLD_BITS) {
+        int complete = position;
+
+        if(data[position] == 0xff && inGap(data, position)) {
+            while(complete < position + NIBBLES_PER_TRACK - 1 && data[complete % NIBBLES_PER_TRACK] == 0xff)
+                complete++;
         }
-        
-        int oldCount = byteCount;
-        byteCount = (++byteCount) % NIBBLES_PER_TRACK;
-        
-        return nibbles[track][oldCount];
+
+        drive.spinCycles += ((complete + 1) * 8 - bit) * CYCLES_PER_BIT - drive.spinCycles % CYCLES_PER_BIT;
+
+        return data[complete % NIBBLES_PER_TRACK];
+    }
+
+    if(shifted < LATCH_HOLD_BITS)
+        return data[(position + NIBBLES_PER_TRACK - 1) % NIBBLES_PER_TRACK];
+
+    return data[position] >> (8 - shifted);
+}
+
+// Bit cells shifted again after a long time without reads
+// Sync bytes bring the shift register back in step within a few bytes
+static const uint64 RESYNC_BITS = 64;
+
+// Latch of a WOZ track, bit streams have no fixed byte boundaries
+// Bits passed since the last read are shifted in, disk bytes start with a 1 bit
+// so the zeros after sync bytes are skipped
+byte Disk::readBits(Drive& drive) {
+    const WozImage::Track* bits = drive.diskImage->woz->track(drive.motorPhase * 2);
+    uint64 now = bitClock(drive);
+
+    if(!bits) {
+        drive.bitsRead = now;
+        return 0;
+    }
+
+    if(now - drive.bitsRead > RESYNC_BITS) {
+        drive.bitsRead = now - RESYNC_BITS;
+        drive.shiftRegister = 0;
+        drive.latchAge = LATCH_HOLD_BITS;
     }
 
+    for( ; drive.bitsRead < now ; drive.bitsRead++) {
+        uint32 position = drive.bitsRead % bits->bitCount;
+
+        drive.shiftRegister = (drive.shiftRegister << 1) | ((bits->bits[position >> 3] >> (7 - (position & 7))) & 1);
+        drive.latchAge++;
+
+        if(drive.shiftRegister & 0x80) {
+            latch = drive.shiftRegister;
+            drive.shiftRegister = 0;
+            drive.latchAge = 0;
+        }
+    }
+
+    return (drive.latchAge < LATCH_HOLD_BITS) ? latch : drive.shiftRegister;
+}
+
+// Shift the latch out to the disk
+// Bytes are written one after the other from where write mode started
+byte Disk::writeNibble(Drive& drive) {
+    if(drive.diskImage->writeProtected)
+        return 0;
+
+    // The byte under the head : the write loop timing, 32 cycles per byte
+    // and 40 for sync bytes, sets where each one lands
+    int position = (bitClock(drive) / 8) % NIBBLES_PER_TRACK;
+
+    drive.writableTrack(drive.track)[position] = latch;
+    drive.dirty[drive.track] = true;
+
     return 0;
-    
 }
 
 byte Disk::selectDrive(byte drive) {
     if(DISK_LOG)
         std::cout << "Drive " << (int)drive << " selected" << std::endl;
-    
+
+    // The motor line follows the selection
+    if(drive != currentDrive && motorEnabled) {
+        stopDrive(currentDrive);
+        startDrive(drive);
+    }
+
     currentDrive = drive;
     return 0;
 }
 
+// Written values load the latch in write mode, see diskWrite
+byte Disk::loadLatch() {
+    loadMode = true;
+    return 0;
+}
+
 byte Disk::setReadMode() {
     if(DISK_LOG)
         std::cout << "Read mode" << std::endl;
 
     writeMode = false;
-    return 0;
+
+    // After $C08D, bit 7 tells whether the disk is write-protected
+    return (loadMode && drives[currentDrive].diskImage->writeProtected) ? 0x80 : 0x00;
 }
 
 byte Disk::setWriteMode() {
@@ -111,8 +422,32 @@ byte Disk::setWriteMode() {
 byte Disk::enableDrive(bool enabled) {
     if(DISK_LOG)
         std::cout << "Drive " << (int)currentDrive << ((enabled) ? " enabled" : " disabled") << std::endl;
-    
-    driveOn[currentDrive] = enabled;
+
+    if(enabled) {
+        if(motorOffEvent) {
+            scheduler->cancel(motorOffEvent);
+            motorOffEvent = 0;
+        }
+
+        motorEnabled = true;
+        startDrive(currentDrive);
+    }
+    else if(motorEnabled && !motorOffEvent) {
+
+        // Without a scheduler, the drive stops at once
+        if(!scheduler) {
+            motorEnabled = false;
+            stopDrive(currentDrive);
+            return 0;
+        }
+
+        motorOffEvent = scheduler->schedule(now() + MOTOR_OFF_DELAY, [this](uint64) {
+            motorOffEvent = 0;
+            motorEnabled = false;
+            stopDrive(currentDrive);
+        });
+    }
+
     return 0;
 }
 
@@ -133,7 +468,7 @@ byte Disk::diskRead(word addr) {
         case 0xa: return selectDrive(0);
         case 0xb: return selectDrive(1);
         case 0xc: return readWriteData();
-        case 0xd: return 0; // TODO set latch value ?
+        case 0xd: return loadLatch();
         case 0xe: return setReadMode();
         case 0xf: return setWriteMode();
 
@@ -143,6 +478,9 @@ byte Disk::diskRead(word addr) {
 
 void Disk::diskWrite(word addr, byte val) {
 
-    // TODO implement writing to disk
     diskRead(addr);
+
+    // Writes load the data latch, shifted out by the next $C0EC access
+    if(writeMode)
+        latch = val;
 }
\ No newline at end of file
@@ -3,10 +3,69 @@
 
 #include "types.hpp"
 #include "disk_images.hpp"
+#include "nibble_cache.hpp"
+#include "card.hpp"
 
-struct Disk {
+// One Disk II drive : its disk, head and spindle
+struct Drive {
+
+    Drive();
+    ~Drive();
+
+    int track;              // Current disk track
+    int motorPhase;         // Current stepper motor track * 2
+
+    // Rotation, see Disk
+    bool spinning;          // Spindle turning
+    uint64 lastCycle;       // Clock at the last update
+    uint64 spinCycles;      // Cycles the disk has turned
+
+    byte shiftRegister;     // WOZ bits of the disk byte being read
+    int latchAge;           // WOZ bit cells since the latch was completed
+    uint64 bitsRead;        // WOZ bit cells shifted so far
+
+    DiskImage *diskImage;
+
+    constexpr static int TRACKS = 35;
+
+    // Nibblized tracks, taken from the shared cache when the head first reads them
+    SharedTrack sharedTracks[TRACKS];
+
+    // Private copies of the tracks written to
+    byte* nibbles[TRACKS];
+
+    // Tracks written since the last flush
+    bool dirty[TRACKS];
+
+    // Pending release of the tracks once the drive is idle, 0 if none
+    uint32 releaseEvent;
+
+    int loadFile(std::string filename, bool writeBack);
+
+    // Nibbles of a track, encoding it if needed
+    const byte* trackNibbles(int track);
+
+    // Private copy of a track, made on the first write
+    byte* writableTrack(int track);
+
+    // Decode dirty tracks back to the image sectors, and queue the changed
+    // sectors to be written back to the file
+    void flush();
+
+    // Forget all encoded tracks
+    void clearTracks();
+
+    // Turn the disk up to the given CPU cycle
+    void spin(uint64 now);
+};
+
+// Disk II controller card and its two drives
+// Magnets, modes and the data latch belong to the controller : only the selected
+// drive steps its head and turns.
+struct Disk : public Card {
 
     Disk();
+    ~Disk();
 
     // Disk bootstrap ROM
     // Loads the first sector of the disk in memory and executes it
@@ -28,36 +87,58 @@ struct Disk {
                     "\x03\x2A\x5E\x00\x03\x2A\x91\x26\xC8\xD0\xEE\xE6\x27\xE6\x3D\xA5"
                     "\x3D\xCD\x00\x08\xA6\x2B\x90\xDB\x4C\x01\x08\x00\x00\x00\x00";
 
-    int track;              // Current disk track
-    int sector;             // Current sector
-    int byteCount;          // 6-bit byte index on disk
-
-    bool writeMode;         // Read/write mode
-
-    int motorPhase;         // Current stepper motor track * 2
+    bool writeMode;         // Read/write mode (Q7)
+    bool loadMode;          // Shift/load mode (Q6), senses write protection when reading
 
     bool magnet[4];         // Magnets
 
     byte currentDrive;      // Selected drive
 
-    bool driveOn[2];        // Drive status
+    bool motorEnabled;      // Motor line, from $C089 until the drive stops
 
-    int curr_byte;          // TODO unused
-    byte shiftRegister;     // TODO unused
+    Drive drives[2];
 
-    bool encoded;           // Check if disk data is encoded
+    // Rotation
+    // The disk turns while the motor is on, one bit cell every 4 CPU cycles and
+    // 32 cycles per disk byte. The head position is computed from the CPU clock.
+    constexpr static int CYCLES_PER_BIT = 4;
 
-    // TODO add write protection
+    // A complete disk byte stays in the latch for 2 bit cells, then the next one shifts in
+    constexpr static int LATCH_HOLD_BITS = 2;
 
-    int spinning;
+    // The drive keeps turning for about a second after $C088
+    constexpr static uint64 MOTOR_OFF_DELAY = 1000000;
 
-    DiskImage *diskImage;
+    // Cycles a stopped drive keeps its encoded tracks, about 10 seconds by default
+    uint64 releaseDelay;
+
+    uint32 motorOffEvent;   // Pending motor stop, 0 if none
 
-    byte nibbles[35][NIBBLES_PER_TRACK] = {0};
+    byte latch;             // Data latch : last complete disk byte, or the byte to write
 
-    int loadFile(std::string filename);
+    // Fast disk : reads never wait for the next disk byte and skip sync gaps
+    // The main loop also runs the CPU unthrottled while the motor is on
+    bool fastMode;
 
-    void encodeAll();
+    // Insert a disk in drive 0 or 1
+    int loadFile(std::string filename, bool writeBack = true, int drive = 0);
+
+    // A disk is in the drive
+    bool loaded(int drive) const { return drives[drive].diskImage->loaded; }
+
+    // Motor of any drive
+    bool motorOn() const { return drives[0].spinning || drives[1].spinning; }
+
+    // Card : I/O, bootstrap ROM once a disk is inserted
+    byte ioRead(word addr) { return diskRead(addr); }
+    void ioWrite(word addr, byte value) { diskWrite(addr, value); }
+    const byte* slotRom();
+
+    // Motor off at once, read mode, magnets off
+    void reset();
+
+    // Cancel the motor and head release events
+    void detach();
 
     byte diskRead(word addr);
     void diskWrite(word addr, byte val);
@@ -65,7 +146,20 @@ struct Disk {
     byte setPhase(byte phase, bool on, word addr);
     byte selectDrive(byte drive);
     byte enableDrive(bool enabled);
+
+    // Spin a drive up, or stop it and write its changes back
+    // Stopped drives release their tracks after releaseDelay
+    void startDrive(int drive);
+    void stopDrive(int drive);
+
+    // Bit cells the disk has turned by
+    uint64 bitClock(Drive& drive);
+
     byte readWriteData();
+    byte readNibble(Drive& drive);
+    byte readBits(Drive& drive);
+    byte writeNibble(Drive& drive);
+    byte loadLatch();
     byte setReadMode();
     byte setWriteMode();
 };
@@ -1,17 +1,42 @@
 #include "disk_images.hpp"
+#include "disk_writer.hpp"
+#include "log.hpp"
 #include <iostream>
 #include <fcntl.h>
 #include <cstdlib>
+#include <cctype>
 #include <unistd.h>
+#include <sys/stat.h>
 
-byte sixAndTwo[0x40] = {
+#ifndef _WIN64
+#include <sys/mman.h>
+#endif
+
+// Only Windows distinguishes binary files
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+const byte sixAndTwo[0x40] = {
     0x96, 0x97, 0x9A, 0x9B, 0x9D, 0x9E, 0x9F, 0xA6, 0xA7, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF, 0xB2, 0xB3,
     0xB4, 0xB5, 0xB6, 0xB7, 0xB9, 0xBA, 0xBB, 0xBC, 0xBD, 0xBE, 0xBF, 0xCB, 0xCD, 0xCE, 0xCF, 0xD3,
     0xD6, 0xD7, 0xD9, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE, 0xDF, 0xE5, 0xE6, 0xE7, 0xE9, 0xEA, 0xEB, 0xEC,
     0xED, 0xEE, 0xEF, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF
 };
 
-byte sectorNumber[3][0x10] = {
+// Disk byte to 6-bit value, 0xff for invalid disk bytes ($80 - $FF only)
+const byte sixAndTwoInverse[0x80] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x01, 0xFF, 0xFF, 0x02, 0x03, 0xFF, 0x04, 0x05, 0x06,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x07, 0x08, 0xFF, 0xFF, 0xFF, 0x09, 0x0A, 0x0B, 0x0C, 0x0D,
+    0xFF, 0xFF, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13, 0xFF, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x1B, 0xFF, 0x1C, 0x1D, 0x1E,
+    0xFF, 0xFF, 0xFF, 0x1F, 0xFF, 0xFF, 0x20, 0x21, 0xFF, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x29, 0x2A, 0x2B, 0xFF, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32,
+    0xFF, 0xFF, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0xFF, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F
+};
+
+const byte sectorNumber[3][0x10] = {
     {0x00, 0x08, 0x01, 0x09, 0x02, 0x0A, 0x03, 0x0B, 0x04, 0x0C, 0x05, 0x0D, 0x06, 0x0E, 0x07, 0x0F},
     {0x00, 0x07, 0x0E, 0x06, 0x0D, 0x05, 0x0C, 0x04, 0x0B, 0x03, 0x0A, 0x02, 0x09, 0x01, 0x08, 0x0F},
     {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
@@ -30,7 +55,7 @@ void encode44(byte b, byte *output) {
 }
 
 // Encode a 256-byte sector into a 342 6-bit bytes
-void encode62(byte* data, byte* output, int sector) {
+void encode62Scalar(const byte* data, byte* output) {
 
     // Result buffer containing 342+1 6-bit bytes
     byte buffer[343];
@@ -73,7 +98,7 @@ void encode62(byte* data, byte* output, int sector) {
 }
 
 // Encode disk track as nibbles
-int encodeNibbles(byte* data, byte* output, bool dosOrder, int track) {
+int encodeNibbles(const byte* data, byte* output, bool dosOrder, int track) {
 
     int pos = 0;
     byte volume = 0xfe;
@@ -136,49 +161,283 @@ int encodeNibbles(byte* data, byte* output, bool dosOrder, int track) {
     return pos;    
 }
 
-int DiskImage::loadFile(std::string filename) {
+void encode62(const byte* data, byte* output, int sector) {
+#if DISK_SIMD
+    encode62Simd(data, output);
+#else
+    encode62Scalar(data, output);
+#endif
+}
+
+// 4-and-4 decoding
+byte decode44(const byte* input) {
+    return ((input[0] << 1) | 0x01) & input[1];
+}
+
+// Decode 343 disk bytes into a 256-byte sector, reverse of encode62
+// Returns false on an invalid disk byte or a checksum error
+bool decode62Scalar(const byte* input, byte* data) {
+
+    // 6-bit values, undoing the running XOR
+    byte buffer[342];
+    byte previous = 0;
+
+    for(int i = 0 ; i < 343 ; i++) {
+        byte value = (input[i] & 0x80) ? sixAndTwoInverse[input[i] & 0x7f] : 0xff;
+
+        if(value == 0xff)
+            return false;
+
+        // The last byte is the checksum
+        if(i == 342) {
+            if(value != previous)
+                return false;
+
+            break;
+        }
+
+        previous ^= value;
+        buffer[i] = previous;
+    }
+
+    // Highest 6 bits from the last 256 values, lowest 2 bits from the first 86
+    for(int i = 0 ; i < 256 ; i++) {
+        byte low = buffer[i % 86] >> ((i / 86) * 2);
+
+        data[i] = (buffer[i + 86] << 2) | REVERSE_BITS(low & 0x03);
+    }
+
+    return true;
+}
+
+bool decode62(const byte* input, byte* data) {
+#if DISK_SIMD
+    return decode62Simd(input, data);
+#else
+    return decode62Scalar(input, data);
+#endif
+}
+
+// Find the sectors of a nibblized track and decode them back to the image
+// Returns the number of sectors decoded
+int decodeNibbles(const byte* input, int size, byte* data, bool dosOrder) {
+
+    int decoded = 0;
+
+    // Nibbles are read around the end of the track, as the disk spins
+    byte field[343];
+
+    for(int pos = 0 ; pos < size ; pos++) {
+
+        // Address field prologue
+        if(input[pos] != 0xd5 || input[(pos + 1) % size] != 0xaa || input[(pos + 2) % size] != 0x96)
+            continue;
+
+        for(int i = 0 ; i < 8 ; i++)
+            field[i] = input[(pos + 3 + i) % size];
+
+        byte sector = decode44(field + 4);
+
+        if(sector > 0x0f)
+            continue;
+
+        // Data field prologue follows within a few sync bytes
+        for(int gap = 3 + 8 ; gap < 3 + 8 + 32 ; gap++) {
+            int start = pos + gap;
+
+            if(input[start % size] != 0xd5 || input[(start + 1) % size] != 0xaa || input[(start + 2) % size] != 0xad)
+                continue;
+
+            for(int i = 0 ; i < 343 ; i++)
+                field[i] = input[(start + 3 + i) % size];
+
+            if(decode62(field, data + sectorNumber[dosOrder ? 1 : 0][sector] * 256))
+                decoded ++;
+
+            break;
+        }
+    }
+
+    return decoded;
+}
+
+// .po files are in ProDOS order, .do files in DOS 3.3 order
+// .dsk files are either : look for a ProDOS volume directory header in block 2
+// and for a DOS 3.3 VTOC on track 17
+static int sectorOrder(std::string filename, const byte* data) {
+    std::string extension = filename.substr(filename.find_last_of('.') + 1);
+
+    for(char& c : extension)
+        c = tolower(c);
+
+    if(extension == "po")
+        return DiskImage::FORMAT_PRODOS;
+
+    if(extension == "do")
+        return DiskImage::FORMAT_DOS;
+
+    const byte* volume = data + 2 * 512;
+    bool prodos = volume[0] == 0 && volume[1] == 0 && (volume[4] & 0xf0) == 0xf0;
+
+    const byte* vtoc = data + diskAddr(17, 0);
+    bool dos = vtoc[1] == 17 && vtoc[3] == 3 && vtoc[0x27] == 122;
+
+    return (prodos && !dos) ? DiskImage::FORMAT_PRODOS : DiskImage::FORMAT_DOS;
+}
+
+DiskImage::DiskImage() {
+    diskFile = nullptr;
+    mapped = false;
+    buffer = nullptr;
+    size = 0;
+    format = FORMAT_DOS;
+    woz = nullptr;
+    fd = -1;
+    writeProtected = false;
+}
+
+DiskImage::~DiskImage() {
+    unload();
+}
 
-    std::cout << "Loading disk " << filename << std::endl;
+void DiskImage::unload() {
+    if(fd != -1) {
+        DiskWriter::shared().sync();
+        close(fd);
+    }
 
-    int fd = open(filename.c_str(), O_RDONLY);
+#ifndef _WIN64
+    if(mapped)
+        munmap(diskFile, size);
+#endif
+
+    delete[] buffer;
+    delete woz;
+
+    diskFile = nullptr;
+    size = 0;
+    format = FORMAT_DOS;
+    woz = nullptr;
+    mapped = false;
+    buffer = nullptr;
+    fd = -1;
+    writeProtected = false;
+    loaded = false;
+}
+
+void DiskImage::writeSector(int offset) {
+    if(fd != -1)
+        DiskWriter::shared().write(fd, offset, diskFile + offset);
+}
+
+int DiskImage::loadFile(std::string filename, bool writeBack) {
+
+    LOG("Loading disk " << filename);
+
+    unload();
+
+    int fd = writeBack ? open(filename.c_str(), O_RDWR | O_BINARY) : -1;
+
+    // Read-only files are loaded write-protected
+    bool readOnly = (fd == -1);
+
+    if(readOnly)
+        fd = open(filename.c_str(), O_RDONLY | O_BINARY);
 
     if(fd == -1) {
-        std::cout << "[ERROR] Could not read file " << filename << std::endl;
+        LOG("[ERROR] Could not read file " << filename);
         return -1;
     }
 
-    int len;
-    int pos = 0;
+    // Check the size before reading anything
+    struct stat info;
 
-    byte b;
+    if(fstat(fd, &info) != 0) {
+        LOG("[ERROR] Could not read file " << filename);
+        close(fd);
+        return -1;
+    }
 
-    len = read(fd, &b, 1);
+    // Sector and nibble images have a fixed size, WOZ images are told apart by their header
+    if(info.st_size != DISK_MAXSIZE && info.st_size != NIB_MAXSIZE && (info.st_size < 12 || info.st_size > WOZ_MAXSIZE)) {
+        LOG("ERROR : wrong disk file size. Expected " << std::dec << (int)DISK_MAXSIZE << " bytes, got " << (long)info.st_size);
+        close(fd);
+        return 1;
+    }
+
+    size = info.st_size;
+
+#ifndef _WIN64
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    if(memory != MAP_FAILED) {
+        diskFile = (byte*)memory;
+        mapped = true;
+    }
+#endif
+
+    // Single read when the file cannot be mapped
+    if(!mapped) {
+        buffer = new byte[size];
+
+        uint32 pos = 0;
+
+        while(pos < size) {
+            int len = read(fd, buffer + pos, size - pos);
+
+            if(len <= 0)
+                break;
 
-    while(len > 0) {
+            pos += len;
+        }
 
-        if(pos >= DISK_MAXSIZE) {
-            std::cout << "ERROR : disk file is too large. Expected " << std::dec << (int)DISK_MAXSIZE << " bytes, disk file is larger." << std::endl;
+        if(pos < size) {
+            LOG("[ERROR] Could not read file " << filename);
             close(fd);
-            return 1;
+            unload();
+            return -1;
         }
 
-        diskFile[pos] = b;
-        len = read(fd, &b, 1);
-        pos ++;
+        diskFile = buffer;
     }
 
-    if(pos < DISK_MAXSIZE) {
-        std::cout << "ERROR : disk file is too small. Expected " << std::dec << (int)DISK_MAXSIZE << " bytes, got " << (int)pos << std::endl;
+    if(WozImage::isWoz(diskFile, size)) {
+        format = FORMAT_WOZ;
+        woz = new WozImage();
+
+        if(!woz->parse(diskFile, size)) {
+            close(fd);
+            unload();
+            return -1;
+        }
+
+        // Bit streams are read-only, nothing is written back
+        readOnly = true;
+    }
+    else if(size == NIB_MAXSIZE)
+        format = FORMAT_NIB;
+    else if(size == DISK_MAXSIZE)
+        format = sectorOrder(filename, diskFile);
+    else {
+        LOG("ERROR : wrong disk file size. Expected " << std::dec << (int)DISK_MAXSIZE << " bytes, got " << size);
         close(fd);
+        unload();
         return 1;
     }
 
-    close(fd);
+    // Kept open for write-back
+    if(readOnly)
+        close(fd);
+    else
+        this->fd = fd;
+
+    writeProtected = (writeBack && readOnly) || woz;
+
+    static const char* formatNames[] = {"DOS order", "ProDOS order", "nibbles", "WOZ"};
 
-    std::cout << "Disk loaded : " << std::dec << (int)pos << " bytes" << std::endl;
+    LOG("Disk loaded : " << std::dec << size << " bytes (" << formatNames[format] << ")");
 
     loaded = true;
 
     return 0;
-
-}
\ No newline at end of file
+}
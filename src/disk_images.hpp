@@ -1,4 +1,5 @@
 #include "types.hpp"
+#include "woz.hpp"
 #include <string>
 #include <fstream>
 
@@ -8,23 +9,95 @@
 #define DISK_MAXSIZE 143360
 #define NIBBLES_PER_TRACK 6656
 
+// .nib images : nibblized tracks stored as is
+#define NIB_MAXSIZE (35 * NIBBLES_PER_TRACK)
 
-extern byte sixAndTwo[0x40];
-extern byte sectorNumber[3][0x10]; 
+// Largest WOZ file accepted
+#define WOZ_MAXSIZE (16 * 1024 * 1024)
+
+// 6-and-2 kernels : 0 = scalar, 1 = SSE2, plus AVX2 table lookups when built with -mavx2
+#ifndef DISK_SIMD
+#define DISK_SIMD 1
+#endif
+
+#if DISK_SIMD && defined(__SSE2__)
+#define DISK_SIMD_SSE2 1
+#else
+#define DISK_SIMD_SSE2 0
+#endif
+
+#if DISK_SIMD_SSE2 && defined(__AVX2__)
+#define DISK_SIMD_AVX2 1
+#else
+#define DISK_SIMD_AVX2 0
+#endif
+
+// Read-only, shared by every drive
+extern const byte sixAndTwo[0x40];
+extern const byte sixAndTwoInverse[0x80];
+extern const byte sectorNumber[3][0x10];
 
 int diskAddr(byte track, byte sector);
 void encode44(byte b, byte *output);
-void encode62(byte* data, byte *output, int sector);
-int encodeNibbles(byte* data, byte *output, bool dosOrder, int track);
+void encode62(const byte* data, byte *output, int sector);
+int encodeNibbles(const byte* data, byte *output, bool dosOrder, int track);
+
+byte decode44(const byte* input);
+bool decode62(const byte* input, byte* data);
+int decodeNibbles(const byte* input, int size, byte* data, bool dosOrder);
+
+// 6-and-2 kernels behind encode62 and decode62, selected by DISK_SIMD
+void encode62Scalar(const byte* data, byte* output);
+bool decode62Scalar(const byte* input, byte* data);
+void encode62Simd(const byte* data, byte* output);
+bool decode62Simd(const byte* input, byte* data);
 
 struct DiskImage {
 
-    byte diskFile[DISK_MAXSIZE];
+    // Image formats
+    constexpr static int FORMAT_DOS = 0;        // .dsk / .do : sectors in DOS 3.3 order
+    constexpr static int FORMAT_PRODOS = 1;     // .po : sectors in ProDOS order
+    constexpr static int FORMAT_NIB = 2;        // .nib : nibblized tracks
+    constexpr static int FORMAT_WOZ = 3;        // .woz : bit streams
+
+    // Sector data, a private copy-on-write view of the file or buffer
+    // Changed sectors are written back to the file by writeSector
+    byte* diskFile;
     bool loaded = false;
 
+    // Mapped from the file, or read in one go into buffer
+    bool mapped;
+    byte* buffer;
+    uint32 size;
+
+    int format;
+
+    // Bit streams of a WOZ image, pointing into diskFile, nullptr for other formats
+    WozImage* woz;
+
+    // File kept open for write-back, -1 when writes stay in memory
+    int fd;
+
+    // The file is read-only or a WOZ image, the drive refuses writes
+    bool writeProtected;
+
+    DiskImage();
+    ~DiskImage();
+
+    // The format is told from the WOZ header, the file size, the extension and
+    // for .dsk files the ProDOS volume directory
+    // Returns 0 on success, -1 if the file cannot be read, 1 if its size is wrong
+    // Without writeBack, sectors written by programs never reach the file
+    int loadFile(std::string filename, bool writeBack = true);
+
+    // Sector images in DOS 3.3 order
+    bool dosOrder() const { return format == FORMAT_DOS; }
 
-    int loadFile(std::string filename);
+    // Queue a sector of diskFile to be written back to the file
+    void writeSector(int offset);
 
+    // Release the current image, once pending writes are done
+    void unload();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <cstring>
+#include <unistd.h>
+#include "disk_writer.hpp"
+#include "log.hpp"
+
+DiskWriter::DiskWriter() {
+    writing = false;
+    stopping = false;
+    thread = nullptr;
+}
+
+// Finish pending writes before the program exits
+DiskWriter::~DiskWriter() {
+    if(!thread)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+
+    wake.notify_one();
+    thread->join();
+
+    delete thread;
+}
+
+DiskWriter& DiskWriter::shared() {
+    static DiskWriter writer;
+    return writer;
+}
+
+void DiskWriter::write(int fd, long offset, const byte* data) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        // Started on the first write, most runs never write to a disk
+        if(!thread)
+            thread = new std::thread(&DiskWriter::run, this);
+
+        pending.push_back({fd, offset, {0}});
+        memcpy(pending.back().data, data, SECTOR_SIZE);
+    }
+
+    wake.notify_one();
+}
+
+void DiskWriter::sync() {
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this] { return pending.empty() && !writing; });
+}
+
+void DiskWriter::run() {
+    std::unique_lock<std::mutex> guard(lock);
+
+    while(true) {
+        wake.wait(guard, [this] { return !pending.empty() || stopping; });
+
+        if(pending.empty())
+            break;
+
+        Write next = pending.front();
+        pending.pop_front();
+        writing = true;
+
+        // Emulation threads keep queueing while the file is written
+        guard.unlock();
+
+        if(lseek(next.fd, next.offset, SEEK_SET) != next.offset || ::write(next.fd, next.data, SECTOR_SIZE) != SECTOR_SIZE)
+            LOG("[ERROR] Could not write disk sector at offset " << std::dec << next.offset);
+
+        guard.lock();
+        writing = false;
+
+        if(pending.empty())
+            done.notify_all();
+    }
+}
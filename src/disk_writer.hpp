@@ -0,0 +1,48 @@
+#ifndef DISK_WRITER_HPP
+#define DISK_WRITER_HPP
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "types.hpp"
+
+// Process-wide background thread writing disk sectors back to image files
+// Flushing a drive only queues its changed sectors, the emulation never waits
+// on the file system. Pending writes are finished before a file is closed and
+// when the program exits.
+struct DiskWriter {
+
+    constexpr static int SECTOR_SIZE = 256;
+
+    struct Write {
+        int fd;
+        long offset;
+        byte data[SECTOR_SIZE];
+    };
+
+    std::mutex lock;
+    std::condition_variable wake;       // Writes queued or stopping
+    std::condition_variable done;       // Queue drained
+
+    std::deque<Write> pending;
+    bool writing;
+    bool stopping;
+
+    std::thread* thread;
+
+    DiskWriter();
+    ~DiskWriter();
+
+    static DiskWriter& shared();
+
+    // Queue a copy of one sector, written at offset in the file
+    void write(int fd, long offset, const byte* data);
+
+    // Wait until every queued write has reached its file
+    void sync();
+
+    void run();
+};
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef EMBEDDED_HPP
+#define EMBEDDED_HPP
+
+#include "types.hpp"
+
+// ROM and character set built into the binary
+// Generated from roms/ by tools/embed_data.py, see the Makefile
+
+// System ROM image
+extern const uint32 embeddedRomSize;
+extern const byte embeddedRom[];
+
+// 128 x 128 character set, 1 bit per pixel, leftmost pixel in bit 7
+constexpr static int CHARSET_SIZE = 128;
+extern const byte embeddedCharset[CHARSET_SIZE * CHARSET_SIZE / 8];
+
+#endif
@@ -0,0 +1,207 @@
+#include <cstring>
+#include "disk_images.hpp"
+
+// Vectorized 6-and-2 kernels
+// Bit packing, XOR chaining and the running XOR use SSE2, which every x86-64
+// target has. Disk byte tables need a byte shuffle : with AVX2 they are
+// looked up 32 bytes at a time, otherwise one byte at a time.
+
+#if DISK_SIMD_SSE2
+
+#include <emmintrin.h>
+
+#if DISK_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+static inline __m128i load(const byte* p) {
+    return _mm_loadu_si128((const __m128i*)p);
+}
+
+static inline void store(byte* p, __m128i v) {
+    _mm_storeu_si128((__m128i*)p, v);
+}
+
+static inline __m128i splat(byte b) {
+    return _mm_set1_epi8((char)b);
+}
+
+// REVERSE_BITS on each byte : swap bits 0 and 1, clear the others
+static inline __m128i reverse2(__m128i v) {
+    __m128i bit0 = _mm_and_si128(v, splat(0x01));
+    __m128i bit1 = _mm_and_si128(_mm_srli_epi16(v, 1), splat(0x01));
+
+    return _mm_or_si128(_mm_add_epi8(bit0, bit0), bit1);
+}
+
+// Byte shifts, bits crossing into the neighbouring byte are masked off
+static inline __m128i shiftLeft2(__m128i v) {
+    return _mm_and_si128(_mm_slli_epi16(v, 2), splat(0xfc));
+}
+
+static inline __m128i shiftRight(__m128i v, int bits) {
+    return _mm_and_si128(_mm_srli_epi16(v, bits), splat(0xff >> bits));
+}
+
+#if DISK_SIMD_AVX2
+
+// Look up 32 bytes in a table of up to 128 entries, indexes in bits 0-6
+// vpshufb reads 16-entry tables, bits 4-6 select between them
+static inline __m256i lookup(const byte* table, int entries, __m256i index) {
+    __m256i low = _mm256_and_si256(index, _mm256_set1_epi8(0x0f));
+    __m256i parts[8];
+
+    for(int i = 0 ; i < entries / 16 ; i++)
+        parts[i] = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(load(table + i * 16)), low);
+
+    // blendv selects on bit 7 : move bits 4, 5, 6 there in turn
+    for(int bit = 4, n = entries / 16 ; n > 1 ; bit++, n /= 2) {
+        __m256i select = _mm256_slli_epi16(index, 7 - bit);
+
+        for(int i = 0 ; i < n / 2 ; i++)
+            parts[i] = _mm256_blendv_epi8(parts[2 * i], parts[2 * i + 1], select);
+    }
+
+    return parts[0];
+}
+
+#endif
+
+void encode62Simd(const byte* data, byte* output) {
+
+    // Zero padding so every 16-byte load stays in bounds
+    // Bytes past the sector read as 0, like the missing third term at 84 and 85
+    byte source[256 + 96] = {0};
+    memcpy(source, data, 256);
+
+    // buffer[0] stays 0 : the XOR chain starts from it
+    byte buffer[1 + 352 + 16] = {0};
+
+    // The first 86 bytes contain the lowest 2 bits of all source bytes
+    for(int i = 0 ; i < 86 ; i += 16) {
+        __m128i packed = _mm_or_si128(reverse2(load(source + i)),
+                         _mm_or_si128(_mm_slli_epi16(reverse2(load(source + i + 86)), 2),
+                                      _mm_slli_epi16(reverse2(load(source + i + 172)), 4)));
+        store(buffer + 1 + i, packed);
+    }
+
+    // The final 256 bytes contain the highest 6 bits
+    for(int i = 0 ; i < 256 ; i += 16)
+        store(buffer + 1 + 86 + i, shiftRight(load(source + i), 2));
+
+    // XOR with the previous byte
+    byte result[352 + 32];
+
+    for(int i = 0 ; i < 352 ; i += 16)
+        store(result + i, _mm_xor_si128(load(buffer + 1 + i), load(buffer + i)));
+
+    // 343rd byte is the last source byte
+    result[342] = buffer[1 + 341];
+
+#if DISK_SIMD_AVX2
+    byte disk[352 + 32];
+
+    for(int i = 0 ; i < 343 ; i += 32) {
+        __m256i index = _mm256_loadu_si256((const __m256i*)(result + i));
+        _mm256_storeu_si256((__m256i*)(disk + i), lookup(sixAndTwo, 64, _mm256_and_si256(index, _mm256_set1_epi8(0x3f))));
+    }
+
+    memcpy(output, disk, 343);
+#else
+    for(int i = 0 ; i < 343 ; i++)
+        output[i] = sixAndTwo[result[i]];
+#endif
+}
+
+bool decode62Simd(const byte* input, byte* data) {
+
+    // 6-bit values, 0xff for invalid disk bytes
+    byte values[352 + 32];
+
+#if DISK_SIMD_AVX2
+    // Padded with a valid disk byte, so only the sector can be invalid
+    byte padded[352];
+    memcpy(padded, input, 343);
+    memset(padded + 343, sixAndTwo[0], sizeof(padded) - 343);
+
+    __m256i invalid = _mm256_setzero_si256();
+
+    for(int i = 0 ; i < 352 ; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(padded + i));
+        __m256i value = lookup(sixAndTwoInverse, 128, bytes);
+
+        // Bit 7 clear is never a disk byte
+        invalid = _mm256_or_si256(invalid, _mm256_cmpgt_epi8(_mm256_setzero_si256(), _mm256_xor_si256(bytes, _mm256_set1_epi8((char)0x80))));
+        invalid = _mm256_or_si256(invalid, _mm256_cmpeq_epi8(value, _mm256_set1_epi8((char)0xff)));
+
+        _mm256_storeu_si256((__m256i*)(values + i), value);
+    }
+
+    if(_mm256_movemask_epi8(invalid))
+        return false;
+#else
+    for(int i = 0 ; i < 343 ; i++) {
+        values[i] = (input[i] & 0x80) ? sixAndTwoInverse[input[i] & 0x7f] : 0xff;
+
+        if(values[i] == 0xff)
+            return false;
+    }
+
+    memset(values + 343, 0, sizeof(values) - 343);
+#endif
+
+    // Running XOR : prefix XOR within 16 bytes, then carry the last byte over
+    byte buffer[352 + 16];
+    __m128i carry = _mm_setzero_si128();
+
+    for(int i = 0 ; i < 352 ; i += 16) {
+        __m128i x = load(values + i);
+
+        x = _mm_xor_si128(x, _mm_slli_si128(x, 1));
+        x = _mm_xor_si128(x, _mm_slli_si128(x, 2));
+        x = _mm_xor_si128(x, _mm_slli_si128(x, 4));
+        x = _mm_xor_si128(x, _mm_slli_si128(x, 8));
+        x = _mm_xor_si128(x, carry);
+
+        store(buffer + i, x);
+
+        // Broadcast byte 15
+        __m128i high = _mm_unpackhi_epi8(x, x);
+        high = _mm_unpackhi_epi16(high, high);
+        carry = _mm_shuffle_epi32(high, 0xff);
+    }
+
+    // The last byte is the checksum
+    if(values[342] != buffer[341])
+        return false;
+
+    // Highest 6 bits from the last 256 values, lowest 2 bits from the first 86
+    // Each pass writes a little past its range, the next one overwrites it
+    byte sector[172 + 96];
+
+    for(int group = 0 ; group < 3 ; group++) {
+        for(int i = 0 ; i < 86 ; i += 16) {
+            __m128i low = reverse2(shiftRight(load(buffer + i), group * 2));
+            __m128i high = shiftLeft2(load(buffer + 86 + group * 86 + i));
+
+            store(sector + group * 86 + i, _mm_or_si128(high, low));
+        }
+    }
+
+    memcpy(data, sector, 256);
+
+    return true;
+}
+
+#else
+
+// No vector unit : the scalar kernels
+void encode62Simd(const byte* data, byte* output) {
+    encode62Scalar(data, output);
+}
+
+bool decode62Simd(const byte* input, byte* data) {
+    return decode62Scalar(input, data);
+}
+
+#endif
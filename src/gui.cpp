@@ -1,12 +1,30 @@
 #include "gui.hpp"
+#include "embedded.hpp"
 #include <iostream>
 
 #ifndef _WIN64
     #include <nfd.h>
 #endif
 
-GUI::GUI(CPU* cpu) {
+GUI::GUI(CPU* cpu, Disk* disk) {
     this->cpu = cpu;
+    this->disk = disk;
+}
+
+// Expand the built-in 1-bit charset to a white on black surface
+SDL_Surface* GUI::createCharset() {
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, CHARSET_SIZE, CHARSET_SIZE, 32, SDL_PIXELFORMAT_RGBA32);
+
+    for(int y = 0 ; y < CHARSET_SIZE ; y++) {
+        uint32* pixels = (uint32*)((byte*)surface->pixels + y * surface->pitch);
+
+        for(int x = 0 ; x < CHARSET_SIZE ; x++) {
+            bool lit = embeddedCharset[(y * CHARSET_SIZE + x) / 8] & (0x80 >> (x % 8));
+            pixels[x] = SDL_MapRGBA(surface->format, lit ? 255 : 0, lit ? 255 : 0, lit ? 255 : 0, 255);
+        }
+    }
+
+    return surface;
 }
 
 void GUI::init() {
@@ -27,8 +45,8 @@ void GUI::init() {
 
         SDL_RenderPresent(renderer);
 
-        // Load charset PNG
-        SDL_Surface *charset = IMG_Load("roms/charset40.png");
+        // Charset
+        SDL_Surface *charset = charsetFile.empty() ? createCharset() : IMG_Load(charsetFile.c_str());
         texCharset = SDL_CreateTextureFromSurface(renderer, charset);
         SDL_FreeSurface(charset);
 
@@ -96,11 +114,11 @@ void GUI::pollEvents() {
 
                     #ifndef _WIN64
                         nfdchar_t *outPath = NULL;
-                        nfdresult_t result = NFD_OpenDialog( "dsk,do", NULL, &outPath );
+                        nfdresult_t result = NFD_OpenDialog( "dsk,do,po,nib,woz", NULL, &outPath );
 
                         if(result == NFD_OKAY) {
                             // Reset Apple 2 with disk
-                            if(cpu->mem->disk->loadFile(outPath) == 0)
+                            if(disk->loadFile(outPath) == 0)
                                 cpu->reset();
                         }
                     #endif
@@ -108,6 +126,34 @@ void GUI::pollEvents() {
                     break;
                 }
 
+                // F4 key inserts a disk in drive 2
+                if(key == SDLK_F4) {
+
+                    #ifndef _WIN64
+                        nfdchar_t *outPath = NULL;
+                        nfdresult_t result = NFD_OpenDialog( "dsk,do,po,nib,woz", NULL, &outPath );
+
+                        if(result == NFD_OKAY)
+                            disk->loadFile(outPath, true, 1);
+                    #endif
+
+                    break;
+                }
+
+                // F9 key toggles fast disk mode
+                if(key == SDLK_F9) {
+                    disk->fastMode = !disk->fastMode;
+                    std::cout << "Fast disk mode " << (disk->fastMode ? "on" : "off") << std::endl;
+                    break;
+                }
+
+                // F10 key toggles cycle-exact CPU timing
+                if(key == SDLK_F10) {
+                    cpu->cycleExact = !cpu->cycleExact;
+                    std::cout << "Cycle-exact mode " << (cpu->cycleExact ? "on" : "off") << std::endl;
+                    break;
+                }
+
                 // F11 key changes color modes
                 if(key == SDLK_F11) {
                     monochrome = !monochrome;
@@ -243,6 +289,9 @@ void GUI::update() {
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
 
+    // With 80STORE on, PAGE2 switches memory banks instead of the displayed page
+    bool displayPage2 = cpu->mem->sw_page2 && !cpu->mem->sw_80store;
+
     // Text mode
     if(cpu->mem->sw_text || cpu->mem->sw_mixed) {
 
@@ -254,10 +303,11 @@ void GUI::update() {
                 int addr = row[y] + x;
 
                 // Page 2
-                if(cpu->mem->sw_page2)
+                if(displayPage2)
                     addr += 0x400;
 
-                byte character = cpu->mem->readByte(addr);
+                // Video always reads main memory
+                byte character = cpu->mem->data[addr];
                 byte charset = character / 64;
 
                 switch(charset) {
@@ -312,11 +362,11 @@ void GUI::update() {
                 int addr = row[y] + x;
 
                 // Page 2
-                if(cpu->mem->sw_page2)
+                if(displayPage2)
                     addr += 0x400;
                     
                 // Read color byte
-                byte byteCol = cpu->mem->readByte(addr);
+                byte byteCol = cpu->mem->data[addr];
 
                 // Read both nibbles
                 for(byte k = 0 ; k < 2 ; k++) {
@@ -345,7 +395,7 @@ void GUI::update() {
     // High-resolution graphics
     if(cpu->mem->sw_hires && !cpu->mem->sw_text) {
 
-        int addr = (cpu->mem->sw_page2) ? 0x4000 : 0x2000;
+        int addr = (displayPage2) ? 0x4000 : 0x2000;
 
         SDL_Color hiResColor[][4] = {
             {
@@ -388,7 +438,7 @@ void GUI::update() {
             // Copy pixel data in buffer
             for(byte blockOffset = 0 ; blockOffset < 40 ; blockOffset ++) {
 
-                byte lineData = cpu->mem->readByte(addr + lineMemOffset + blockOffset);
+                byte lineData = cpu->mem->data[addr + lineMemOffset + blockOffset];
 
                 // Copy first 7 bits
                 for(byte dataBit = 0; dataBit < 7 ; dataBit++) {
@@ -5,6 +5,7 @@
 #include <SDL2/SDL_image.h>
 #include <unordered_map>
 #include "cpu.hpp"
+#include "disk_drive.hpp"
 
 #define SCREEN_W 280
 #define SCREEN_H 192
@@ -13,9 +14,10 @@
 
 struct GUI {
 
-    GUI(CPU* cpu);
+    GUI(CPU* cpu, Disk* disk);
 
     CPU* cpu;
+    Disk* disk;     // Controller the disk keys act on
 
     // Keyboard settings
     uint32 key;
@@ -40,6 +42,11 @@ struct GUI {
     SDL_Texture *texCharset;
     SDL_Texture *texScreen;
 
+    // Charset PNG replacing the built-in one, if set
+    std::string charsetFile;
+
+    SDL_Surface* createCharset();
+
     // Display scale
     uint32 scale = 3;
 
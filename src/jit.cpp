@@ -0,0 +1,858 @@
+#include "jit.hpp"
+#include "log.hpp"
+
+#if CPU_JIT
+
+#include <iostream>
+#include <iomanip>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <sys/mman.h>
+
+namespace {
+
+// Host registers
+enum Register { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// Register allocation
+// RBP : CPU*, R12 / R13 / R14 : A / X / Y, RBX : carry, R15 : last N/Z result (CPU::nResult / zResult),
+// RSI : page cross cycles, everything else is scratch
+constexpr int REG_A = R12;
+constexpr int REG_X = R13;
+constexpr int REG_Y = R14;
+constexpr int REG_C = RBX;
+constexpr int REG_NZ = R15;
+constexpr int REG_CYCLES = RSI;
+
+// ALU opcodes (op r/m32, r32)
+enum { ADD = 0x01, OR = 0x09, AND = 0x21, SUB = 0x29, XOR = 0x31, CMP = 0x39, MOV = 0x89 };
+
+// Immediate group extensions (op r/m32, imm32)
+enum { ADD_I = 0, OR_I = 1, AND_I = 4, SUB_I = 5, XOR_I = 6, CMP_I = 7 };
+
+// Shift extensions
+enum { SHL = 4, SHR = 5 };
+
+// Condition codes
+enum { CC_AE = 0x3, CC_Z = 0x4, CC_NE = 0x5 };
+
+// x86-64 machine code writer, only the forms the compiler needs
+struct Emitter {
+
+    byte* code;
+    uint32 size;
+    uint32 pos;
+
+    Emitter(byte* code, uint32 size) : code(code), size(size), pos(0) {}
+
+    bool overflow() { return pos > size; }
+
+    void b(byte value) {
+        if(pos < size)
+            code[pos] = value;
+        pos ++;
+    }
+
+    void d32(uint32 value) {
+        for(int i = 0 ; i < 4 ; i++)
+            b(value >> (i * 8));
+    }
+
+    void d64(uint64_t value) {
+        for(int i = 0 ; i < 8 ; i++)
+            b(value >> (i * 8));
+    }
+
+    // REX prefix, always emitted for byte registers so SPL..DIL are never AH..BH
+    void rex(bool w, int reg, int index, int base, bool byteReg = false) {
+        byte prefix = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+
+        if(prefix != 0x40 || byteReg)
+            b(prefix);
+    }
+
+    void modrm(int mod, int reg, int rm) { b((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+
+    // op dst, src (32-bit)
+    void rr(byte opcode, int dst, int src) { rex(false, src, 0, dst); b(opcode); modrm(3, src, dst); }
+
+    // mov dst, src (64-bit)
+    void movPointer(int dst, int src) { rex(true, src, 0, dst); b(MOV); modrm(3, src, dst); }
+
+    // op dst, imm32
+    void ri(int ext, int dst, uint32 imm) { rex(false, 0, 0, dst); b(0x81); modrm(3, ext, dst); d32(imm); }
+
+    // mov dst, imm32
+    void movi(int dst, uint32 imm) { rex(false, 0, 0, dst); b(0xb8 + (dst & 7)); d32(imm); }
+
+    // mov dst, imm64
+    void movi64(int dst, const void* ptr) { rex(true, 0, 0, dst); b(0xb8 + (dst & 7)); d64((uint64_t)ptr); }
+
+    // shl / shr dst, imm8
+    void shift(int ext, int dst, byte count) { rex(false, 0, 0, dst); b(0xc1); modrm(3, ext, dst); b(count); }
+
+    // movzx dst, byte [rbp + disp8]
+    void loadField(int dst, int disp) { rex(false, dst, 0, RBP); b(0x0f); b(0xb6); modrm(1, dst, RBP); b(disp); }
+
+    // mov byte [rbp + disp8], src
+    void storeField(int disp, int src) { rex(false, src, 0, RBP, true); b(0x88); modrm(1, src, RBP); b(disp); }
+
+    // and / or byte [rbp + disp8], imm8
+    void updateField(int ext, int disp, byte value) { b(0x80); modrm(1, ext, RBP); b(disp); b(value); }
+
+    // mov dst, [base + index * 8]
+    void loadPointer(int dst, int base, int index) {
+        rex(true, dst, index, base);
+        b(0x8b);
+        modrm(0, dst, 4);
+        modrm(3, index, base);
+    }
+
+    // movzx dst, byte [base + index]
+    void loadByte(int dst, int base, int index) {
+        rex(false, dst, index, base);
+        b(0x0f); b(0xb6);
+        modrm(0, dst, 4);
+        modrm(0, index, base);
+    }
+
+    // mov byte [base + index], src
+    void storeByte(int base, int index, int src) {
+        rex(false, src, index, base, true);
+        b(0x88);
+        modrm(0, src, 4);
+        modrm(0, index, base);
+    }
+
+    // cmp dst, src (64-bit)
+    void cmpPointer(int dst, int src) { rex(true, src, 0, dst); b(CMP); modrm(3, src, dst); }
+
+    // test reg, reg (64-bit)
+    void testPointer(int reg) { rex(true, reg, 0, reg); b(0x85); modrm(3, reg, reg); }
+
+    // setcc dst ; movzx dst, dst
+    void setcc(int cc, int dst) {
+        rex(false, 0, 0, dst, true); b(0x0f); b(0x90 | cc); modrm(3, 0, dst);
+        rex(false, dst, 0, dst, true); b(0x0f); b(0xb6); modrm(3, dst, dst);
+    }
+
+    // jcc rel32, returns the offset to patch
+    uint32 jcc(int cc) {
+        b(0x0f); b(0x80 | cc);
+        uint32 at = pos;
+        d32(0);
+        return at;
+    }
+
+    // Point a jump at the current position
+    void patch(uint32 at) {
+        uint32 rel = pos - (at + 4);
+
+        for(int i = 0 ; i < 4 && at + i < size ; i++)
+            code[at + i] = rel >> (i * 8);
+    }
+
+    void push(int reg) { rex(false, 0, 0, reg); b(0x50 + (reg & 7)); }
+    void pop(int reg) { rex(false, 0, 0, reg); b(0x58 + (reg & 7)); }
+    void ret() { b(0xc3); }
+};
+
+enum AddressingMode { IMP, ACC, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY, IZY };
+
+enum Kind { NONE, LD, ST, ORA, AND_, EOR, ADC, SBC, CMP_, ASL, ROL, LSR, ROR, INC, DEC, INR, DER, TRANSFER, TXS, TSX, SETC, SETFLAG, NOP };
+
+// Compiled form of an opcode
+struct Op {
+    Kind kind;
+    int mode;
+    int reg;            // Register operand, destination of transfers
+    int src;            // Source of transfers
+    int flag;           // Status register bit for SETFLAG
+    byte value;         // Value for SETC / SETFLAG
+};
+
+Op describe(byte opcode) {
+
+    Op op = { NONE, IMP, REG_A, 0, 0, 0 };
+
+    switch(opcode) {
+
+        // LDX, LDY, STX, STY, CPX, CPY
+        case 0xa2: op = { LD, IMM, REG_X }; break;
+        case 0xa6: op = { LD, ZP,  REG_X }; break;
+        case 0xb6: op = { LD, ZPY, REG_X }; break;
+        case 0xae: op = { LD, ABS, REG_X }; break;
+        case 0xbe: op = { LD, ABY, REG_X }; break;
+        case 0xa0: op = { LD, IMM, REG_Y }; break;
+        case 0xa4: op = { LD, ZP,  REG_Y }; break;
+        case 0xb4: op = { LD, ZPX, REG_Y }; break;
+        case 0xac: op = { LD, ABS, REG_Y }; break;
+        case 0xbc: op = { LD, ABX, REG_Y }; break;
+        case 0x86: op = { ST, ZP,  REG_X }; break;
+        case 0x96: op = { ST, ZPY, REG_X }; break;
+        case 0x8e: op = { ST, ABS, REG_X }; break;
+        case 0x84: op = { ST, ZP,  REG_Y }; break;
+        case 0x94: op = { ST, ZPX, REG_Y }; break;
+        case 0x8c: op = { ST, ABS, REG_Y }; break;
+        case 0xe0: op = { CMP_, IMM, REG_X }; break;
+        case 0xe4: op = { CMP_, ZP,  REG_X }; break;
+        case 0xec: op = { CMP_, ABS, REG_X }; break;
+        case 0xc0: op = { CMP_, IMM, REG_Y }; break;
+        case 0xc4: op = { CMP_, ZP,  REG_Y }; break;
+        case 0xcc: op = { CMP_, ABS, REG_Y }; break;
+
+        // Register increments and transfers
+        case 0xe8: op = { INR, IMP, REG_X }; break;
+        case 0xc8: op = { INR, IMP, REG_Y }; break;
+        case 0xca: op = { DER, IMP, REG_X }; break;
+        case 0x88: op = { DER, IMP, REG_Y }; break;
+        case 0xaa: op = { TRANSFER, IMP, REG_X, REG_A }; break;
+        case 0xa8: op = { TRANSFER, IMP, REG_Y, REG_A }; break;
+        case 0x8a: op = { TRANSFER, IMP, REG_A, REG_X }; break;
+        case 0x98: op = { TRANSFER, IMP, REG_A, REG_Y }; break;
+        case 0xba: op = { TSX }; break;
+        case 0x9a: op = { TXS }; break;
+
+        // Flags
+        // SED is left to the interpreter, compiled code only runs in binary mode
+        case 0x18: op = { SETC, IMP, 0, 0, 0, 0 }; break;
+        case 0x38: op = { SETC, IMP, 0, 0, 0, 1 }; break;
+        case 0x58: op = { SETFLAG, IMP, 0, 0, CPU::FLAG_I, 0 }; break;
+        case 0x78: op = { SETFLAG, IMP, 0, 0, CPU::FLAG_I, 1 }; break;
+        case 0xb8: op = { SETFLAG, IMP, 0, 0, CPU::FLAG_V, 0 }; break;
+        case 0xd8: op = { SETFLAG, IMP, 0, 0, CPU::FLAG_D, 0 }; break;
+
+        case 0xea: op = { NOP }; break;
+
+        default:
+            // ORA, AND, EOR, ADC, STA, LDA, CMP, SBC : aaabbb01
+            if((opcode & 3) == 1) {
+                static const int modes[8] = { IMP, ZP, IMM, ABS, IZY, ZPX, ABY, ABX };
+                static const Kind kinds[8] = { ORA, AND_, EOR, ADC, ST, LD, CMP_, SBC };
+
+                op.kind = kinds[opcode >> 5];
+                op.mode = modes[(opcode >> 2) & 7];
+
+                // (a8,X) and STA #d8
+                if(op.mode == IMP || (op.kind == ST && op.mode == IMM))
+                    op.kind = NONE;
+            }
+            // ASL, ROL, LSR, ROR, DEC, INC : aaabbb10
+            else if((opcode & 3) == 2 && (opcode >> 5) != 4 && (opcode >> 5) != 5) {
+                static const int modes[8] = { IMP, ZP, ACC, ABS, IMP, ZPX, IMP, ABX };
+                static const Kind kinds[8] = { ASL, ROL, LSR, ROR, NONE, NONE, DEC, INC };
+
+                op.kind = kinds[opcode >> 5];
+                op.mode = modes[(opcode >> 2) & 7];
+
+                if(op.mode == IMP || (op.mode == ACC && (op.kind == DEC || op.kind == INC)))
+                    op.kind = NONE;
+            }
+    }
+
+    return op;
+}
+
+// Compiler state for one piece of code
+struct Compiler {
+
+    Emitter e;
+    Mem* mem;
+
+    // Whether REG_NZ holds the N/Z flags
+    bool nzLive;
+
+    // Exits taken before an instruction that needs the interpreter
+    struct Exit {
+        uint32 jump;
+        int index;
+        bool nzLive;
+    };
+
+    std::vector<Exit> exits;
+
+    int index;
+
+    Compiler(byte* out, uint32 size, Mem* mem) : e(out, size), mem(mem), nzLive(false), index(0) {}
+
+    // Leave to the interpreter on a condition
+    void bail(int cc) {
+        exits.push_back({ e.jcc(cc), index, nzLive });
+    }
+
+    // Leave to the interpreter if the pointer in RAX is null
+    void bailIfNull() {
+        e.testPointer(RAX);
+        bail(CC_Z);
+    }
+
+    void setNZ(int reg) {
+        e.rr(MOV, REG_NZ, reg);
+        nzLive = true;
+    }
+
+    // Page of an indexed address
+    // EDX : address before wrapping, R8 : page before indexing
+    void indexedPage(const void* table, bool pageCrossCycle) {
+        e.rr(MOV, R9, RDX);
+        e.shift(SHR, R9, 8);
+        e.ri(AND_I, R9, 0xff);
+        e.movi64(RCX, table);
+        e.loadPointer(RAX, RCX, R9);
+        bailIfNull();
+
+        // Extra cycle for page boundary cross
+        if(pageCrossCycle) {
+            e.rr(MOV, RCX, RDX);
+            e.shift(SHR, RCX, 8);
+            e.rr(CMP, RCX, R8);
+            e.setcc(CC_NE, RCX);
+            e.rr(ADD, REG_CYCLES, RCX);
+        }
+
+        e.ri(AND_I, RDX, 0xff);
+    }
+
+    // Host pointer to the page of the effective address in RAX, offset in EDX, page number in R9
+    void address(int mode, word operand, bool write, bool pageCrossCycle = true) {
+
+        const void* table = write ? (const void*)mem->writePages : (const void*)mem->readPages;
+
+        switch(mode) {
+            case ZP:
+            case ABS:
+                e.movi64(RCX, table);
+                e.movi(R9, operand >> 8);
+                e.loadPointer(RAX, RCX, R9);
+                bailIfNull();
+                e.movi(RDX, operand & 0xff);
+                break;
+
+            case ZPX:
+            case ZPY:
+                e.rr(MOV, RDX, mode == ZPX ? REG_X : REG_Y);
+                e.ri(ADD_I, RDX, operand & 0xff);
+                e.ri(AND_I, RDX, 0xff);
+                e.movi64(RCX, table);
+                e.movi(R9, 0);
+                e.loadPointer(RAX, RCX, R9);
+                bailIfNull();
+                break;
+
+            case ABX:
+            case ABY:
+                e.rr(MOV, RDX, mode == ABX ? REG_X : REG_Y);
+                e.ri(ADD_I, RDX, operand);
+                e.movi(R8, operand >> 8);
+                indexedPage(table, pageCrossCycle);
+                break;
+
+            case IZY:
+                // Base address from the zero page
+                e.movi64(RCX, mem->readPages);
+                e.movi(RAX, 0);
+                e.loadPointer(RAX, RCX, RAX);
+                bailIfNull();
+                e.movi(RCX, operand);
+                e.loadByte(RDX, RAX, RCX);
+                e.movi(RCX, operand + 1);
+                e.loadByte(RCX, RAX, RCX);
+                e.shift(SHL, RCX, 8);
+                e.rr(OR, RDX, RCX);
+
+                e.rr(MOV, R8, RDX);
+                e.shift(SHR, R8, 8);
+                e.rr(ADD, RDX, REG_Y);
+                indexedPage(table, pageCrossCycle);
+                break;
+        }
+    }
+
+    // Read-modify-write operand page in RAX, like CPU::modify only pages
+    // with the same read and write pointer are modified in place
+    void modifyAddress(int mode, word operand) {
+        address(mode, operand, true, false);
+        e.movi64(RCX, mem->readPages);
+        e.loadPointer(RCX, RCX, R9);
+        e.cmpPointer(RAX, RCX);
+        bail(CC_NE);
+    }
+
+    // Operand value in ECX
+    void value(int mode, word operand) {
+        if(mode == IMM) {
+            e.movi(RCX, operand & 0xff);
+            return;
+        }
+
+        address(mode, operand, false);
+        e.loadByte(RCX, RAX, RDX);
+    }
+
+    // Shifts and rotations of a register, R9 and R10 are used as scratch
+    void shift(Kind kind, int reg) {
+        switch(kind) {
+            case ASL:
+                e.rr(MOV, R9, reg);
+                e.shift(SHR, R9, 7);
+                e.shift(SHL, reg, 1);
+                e.ri(AND_I, reg, 0xff);
+                break;
+            case LSR:
+                e.rr(MOV, R9, reg);
+                e.ri(AND_I, R9, 1);
+                e.shift(SHR, reg, 1);
+                break;
+            case ROL:
+                e.rr(MOV, R9, reg);
+                e.shift(SHR, R9, 7);
+                e.shift(SHL, reg, 1);
+                e.rr(OR, reg, REG_C);
+                e.ri(AND_I, reg, 0xff);
+                break;
+            case ROR:
+                e.rr(MOV, R9, reg);
+                e.ri(AND_I, R9, 1);
+                e.shift(SHR, reg, 1);
+                e.rr(MOV, R10, REG_C);
+                e.shift(SHL, R10, 7);
+                e.rr(OR, reg, R10);
+                break;
+            default:
+                break;
+        }
+
+        e.rr(MOV, REG_C, R9);
+        setNZ(reg);
+    }
+
+    // A + ECX + carry, binary mode
+    void adc() {
+        e.rr(MOV, RAX, REG_A);
+        e.rr(ADD, RAX, RCX);
+        e.rr(ADD, RAX, REG_C);
+
+        // Overflow if the result sign differs from both operands
+        e.rr(MOV, RDX, REG_A);
+        e.rr(XOR, RDX, RAX);
+        e.rr(MOV, R8, RCX);
+        e.rr(XOR, R8, RAX);
+        e.rr(AND, RDX, R8);
+        e.shift(SHR, RDX, 1);
+        e.ri(AND_I, RDX, CPU::FLAG_V);
+        e.loadField(R8, offsetof(CPU, p));
+        e.ri(AND_I, R8, (byte)~CPU::FLAG_V);
+        e.rr(OR, R8, RDX);
+        e.storeField(offsetof(CPU, p), R8);
+
+        e.rr(MOV, REG_C, RAX);
+        e.shift(SHR, REG_C, 8);
+        e.ri(AND_I, RAX, 0xff);
+        e.rr(MOV, REG_A, RAX);
+        setNZ(REG_A);
+    }
+
+    void instruction(const Op& op, word operand) {
+        switch(op.kind) {
+            case LD:
+                value(op.mode, operand);
+                e.rr(MOV, op.reg, RCX);
+                setNZ(op.reg);
+                break;
+
+            case ST:
+                address(op.mode, operand, true, false);
+                e.storeByte(RAX, RDX, op.reg);
+                break;
+
+            case ORA:
+            case AND_:
+            case EOR:
+                value(op.mode, operand);
+                e.rr(op.kind == ORA ? OR : op.kind == AND_ ? AND : XOR, REG_A, RCX);
+                setNZ(REG_A);
+                break;
+
+            case SBC:
+                value(op.mode, operand);
+                e.ri(XOR_I, RCX, 0xff);
+                adc();
+                break;
+
+            case ADC:
+                value(op.mode, operand);
+                adc();
+                break;
+
+            case CMP_:
+                value(op.mode, operand);
+                e.rr(CMP, op.reg, RCX);
+                e.setcc(CC_AE, REG_C);
+                e.rr(MOV, RAX, op.reg);
+                e.rr(SUB, RAX, RCX);
+                e.ri(AND_I, RAX, 0xff);
+                setNZ(RAX);
+                break;
+
+            case ASL:
+            case ROL:
+            case LSR:
+            case ROR:
+                if(op.mode == ACC) {
+                    shift(op.kind, REG_A);
+                    break;
+                }
+
+                modifyAddress(op.mode, operand);
+                e.loadByte(R11, RAX, RDX);
+                shift(op.kind, R11);
+                e.storeByte(RAX, RDX, R11);
+                break;
+
+            case INC:
+            case DEC:
+                modifyAddress(op.mode, operand);
+                e.loadByte(R11, RAX, RDX);
+                e.ri(op.kind == INC ? ADD_I : SUB_I, R11, 1);
+                e.ri(AND_I, R11, 0xff);
+                setNZ(R11);
+                e.storeByte(RAX, RDX, R11);
+                break;
+
+            case INR:
+            case DER:
+                e.ri(op.kind == INR ? ADD_I : SUB_I, op.reg, 1);
+                e.ri(AND_I, op.reg, 0xff);
+                setNZ(op.reg);
+                break;
+
+            case TRANSFER:
+                e.rr(MOV, op.reg, op.src);
+                setNZ(op.reg);
+                break;
+
+            case TSX:
+                e.loadField(REG_X, offsetof(CPU, sp));
+                setNZ(REG_X);
+                break;
+
+            case TXS:
+                e.storeField(offsetof(CPU, sp), REG_X);
+                break;
+
+            case SETC:
+                e.movi(REG_C, op.value);
+                break;
+
+            case SETFLAG:
+                if(op.value)
+                    e.updateField(OR_I, offsetof(CPU, p), op.flag);
+                else
+                    e.updateField(AND_I, offsetof(CPU, p), ~op.flag);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    void prologue() {
+        e.push(RBX);
+        e.push(RBP);
+        e.push(R12);
+        e.push(R13);
+        e.push(R14);
+        e.push(R15);
+
+        e.movPointer(RBP, RDI);
+        e.movi(REG_CYCLES, 0);
+        e.loadField(REG_A, offsetof(CPU, a));
+        e.loadField(REG_X, offsetof(CPU, x));
+        e.loadField(REG_Y, offsetof(CPU, y));
+        e.loadField(REG_C, offsetof(CPU, p));
+        e.ri(AND_I, REG_C, CPU::FLAG_C);
+    }
+
+    // Write registers back and return the instruction count
+    void epilogue(int count, bool nz) {
+        e.storeField(offsetof(CPU, a), REG_A);
+        e.storeField(offsetof(CPU, x), REG_X);
+        e.storeField(offsetof(CPU, y), REG_Y);
+        e.loadField(RAX, offsetof(CPU, p));
+        e.ri(AND_I, RAX, (byte)~CPU::FLAG_C);
+        e.rr(OR, RAX, REG_C);
+        e.storeField(offsetof(CPU, p), RAX);
+
+        if(nz) {
+            e.storeField(offsetof(CPU, nResult), REG_NZ);
+            e.storeField(offsetof(CPU, zResult), REG_NZ);
+        }
+
+        e.rr(MOV, RAX, REG_CYCLES);
+        e.shift(SHL, RAX, 8);
+        e.ri(OR_I, RAX, count);
+
+        e.pop(R15);
+        e.pop(R14);
+        e.pop(R13);
+        e.pop(R12);
+        e.pop(RBP);
+        e.pop(RBX);
+        e.ret();
+    }
+};
+
+// Address of an instruction in a block
+word opAddress(Block* block, int index) {
+    word pc = block->start;
+
+    for(int i = 0 ; i < index ; i++)
+        pc += block->ops[i].length;
+
+    return pc;
+}
+
+// Registers compared by the differential test
+struct Registers {
+    byte a, x, y, sp, p, nResult, zResult;
+    word pc;
+    long cycles;
+    uint64 cycleStamp;
+
+    Registers(CPU* cpu) :
+        a(cpu->a), x(cpu->x), y(cpu->y), sp(cpu->sp),
+        p(cpu->p), nResult(cpu->nResult), zResult(cpu->zResult),
+        pc(cpu->pc), cycles(cpu->cycles), cycleStamp(cpu->cycleStamp) {}
+
+    // Packed status register, N and Z derived like CPU::getFlagRegister
+    byte flags() const {
+        return (p & ~(CPU::FLAG_N | CPU::FLAG_Z)) | (nResult & CPU::FLAG_N) | (zResult ? 0 : CPU::FLAG_Z);
+    }
+
+    bool operator==(const Registers& r) const {
+        return  a == r.a && x == r.x && y == r.y && sp == r.sp &&
+                flags() == r.flags() && pc == r.pc && cycles == r.cycles && cycleStamp == r.cycleStamp;
+    }
+
+    void restore(CPU* cpu) const {
+        cpu->a = a; cpu->x = x; cpu->y = y; cpu->sp = sp;
+        cpu->p = p; cpu->nResult = nResult; cpu->zResult = zResult;
+        cpu->pc = pc; cpu->cycles = cycles; cpu->cycleStamp = cycleStamp;
+    }
+
+    void print() const {
+        std::cout << std::hex << std::setfill('0')
+                  << "pc=" << std::setw(4) << (int)pc
+                  << " a=" << std::setw(2) << (int)a << " x=" << std::setw(2) << (int)x
+                  << " y=" << std::setw(2) << (int)y << " sp=" << std::setw(2) << (int)sp
+                  << " p=" << std::setw(2) << (int)flags()
+                  << std::dec << " cycles=" << cycles << std::endl;
+    }
+};
+
+}
+
+JIT::JIT(CPU* cpu, BlockCache* cache) {
+    this->cpu = cpu;
+    this->mem = cpu->mem;
+    this->cache = cache;
+
+    used = 0;
+
+    void* memory = mmap(nullptr, BUFFER_SIZE + SCRATCH_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(memory == MAP_FAILED) {
+        LOG("Could not allocate executable memory, JIT disabled");
+        buffer = nullptr;
+        scratch = nullptr;
+        return;
+    }
+
+    buffer = (byte*)memory;
+    scratch = buffer + BUFFER_SIZE;
+}
+
+JIT::~JIT() {
+    if(buffer)
+        munmap(buffer, BUFFER_SIZE + SCRATCH_SIZE);
+}
+
+int JIT::compilable(Block* block) {
+    int count = 0;
+
+    while(count < block->count) {
+        const MicroOp& op = block->ops[count];
+        Op compiled = describe(op.opcode);
+
+        if(compiled.kind == NONE)
+            break;
+
+        // (a8),Y reading its base across the zero page boundary
+        if(compiled.mode == IZY && (op.operand & 0xff) == 0xff)
+            break;
+
+        count ++;
+    }
+
+    return count;
+}
+
+NativeCode JIT::compile(Block* block, int first, int last, byte* out, uint32 size) {
+
+    Compiler compiler(out, size, mem);
+
+    compiler.prologue();
+
+    for(int i = first ; i < last ; i++) {
+        compiler.index = i - first;
+        compiler.instruction(describe(block->ops[i].opcode), block->ops[i].operand);
+    }
+
+    compiler.epilogue(last - first, compiler.nzLive);
+
+    // Exits back to the interpreter
+    for(const Compiler::Exit& exit : compiler.exits) {
+        compiler.e.patch(exit.jump);
+        compiler.epilogue(exit.index, exit.nzLive);
+    }
+
+    if(compiler.e.overflow())
+        return nullptr;
+
+    used += compiler.e.pos;
+
+    return (NativeCode)out;
+}
+
+void JIT::flush() {
+    used = 0;
+
+    for(int i = 0 ; i < 0x10000 ; i++) {
+        if(cache->blocks[i])
+            cache->blocks[i]->code = nullptr;
+    }
+}
+
+int JIT::finish(Block* block, int first, uint32 result) {
+    int count = result & 0xff;
+    int cycles = result >> 8;
+
+    for(int i = first ; i < first + count ; i++)
+        cycles += block->ops[i].cycles;
+
+    if(count) {
+        cpu->pc = opAddress(block, first + count);
+        cpu->currentOpcode = block->ops[first + count - 1].opcode;
+        cpu->decrementCycles(cycles);
+    }
+
+    return count;
+}
+
+int JIT::run(Block* block) {
+
+    // Compiled code only implements binary arithmetic, and always counts
+    // page cross cycles, which the interpreter skips when ignoring cycles
+    if(!buffer || cpu->decimal() || cpu->ignoreCycles)
+        return 0;
+
+    if(!block->code) {
+        if(block->hits < 0 || ++block->hits < HOT_THRESHOLD)
+            return 0;
+
+        int count = compilable(block);
+
+        if(count == 0) {
+            block->hits = -1;
+            return 0;
+        }
+
+        block->code = compile(block, 0, count, buffer + used, BUFFER_SIZE - used);
+
+        if(!block->code) {
+            flush();
+            block->code = compile(block, 0, count, buffer, BUFFER_SIZE);
+        }
+    }
+
+#if CPU_JIT == 2
+    return verify(block);
+#else
+    return finish(block, 0, block->code(cpu));
+#endif
+}
+
+#if CPU_JIT == 2
+int JIT::verify(Block* block) {
+
+    Registers before(cpu);
+    memcpy(ram[0], mem->data, Mem::MAX_SIZE);
+    memcpy(ram[1], mem->auxData, Mem::MAX_SIZE);
+    memcpy(bank1, mem->lcBank1, sizeof(bank1));
+
+    // Compiled code, one instruction at a time
+    std::vector<Registers> compiled;
+    int count = compilable(block);
+
+    uint32 saved = used;
+
+    for(int i = 0 ; i < count ; i++) {
+        NativeCode code = compile(block, i, i + 1, scratch, SCRATCH_SIZE);
+        used = saved;
+
+        if(!finish(block, i, code(cpu)))
+            break;
+
+        compiled.push_back(Registers(cpu));
+    }
+
+    memcpy(compiledRam[0], mem->data, Mem::MAX_SIZE);
+    memcpy(compiledRam[1], mem->auxData, Mem::MAX_SIZE);
+    memcpy(compiledBank1, mem->lcBank1, sizeof(compiledBank1));
+
+    // Interpreter from the same state
+    before.restore(cpu);
+    memcpy(mem->data, ram[0], Mem::MAX_SIZE);
+    memcpy(mem->auxData, ram[1], Mem::MAX_SIZE);
+    memcpy(mem->lcBank1, bank1, sizeof(bank1));
+
+    for(int i = 0 ; i < (int)compiled.size() ; i++) {
+        const MicroOp& op = block->ops[i];
+
+        cpu->pc += op.length;
+        cpu->decrementCycles(op.cycles);
+        cpu->currentOpcode = op.opcode;
+        op.execute(cpu, op.operand);
+
+        Registers interpreted(cpu);
+
+        if(!(interpreted == compiled[i]) && logEnabled) {
+            std::cout << "JIT mismatch, opcode " << std::hex << (int)op.opcode << " at " << opAddress(block, i) << std::dec << std::endl;
+            std::cout << "  interpreter : "; interpreted.print();
+            std::cout << "  compiled    : "; compiled[i].print();
+        }
+    }
+
+    for(int bank = 0 ; bank < 2 ; bank++) {
+        const byte* interpreted = bank ? mem->auxData : mem->data;
+
+        for(uint32 addr = 0 ; addr < Mem::MAX_SIZE ; addr++) {
+            if(interpreted[addr] != compiledRam[bank][addr] && logEnabled)
+                std::cout << "JIT memory mismatch in block " << std::hex << block->start << " at " << (bank ? "aux " : "") << addr
+                          << " : " << (int)interpreted[addr] << " / " << (int)compiledRam[bank][addr] << std::dec << std::endl;
+        }
+
+        for(uint32 addr = 0 ; addr < 0x1000 ; addr++) {
+            if(mem->lcBank1[bank][addr] != compiledBank1[bank][addr] && logEnabled)
+                std::cout << "JIT memory mismatch in block " << std::hex << block->start << " at " << (bank ? "aux " : "") << "bank 1 " << (0xd000 + addr)
+                          << " : " << (int)mem->lcBank1[bank][addr] << " / " << (int)compiledBank1[bank][addr] << std::dec << std::endl;
+        }
+    }
+
+    return compiled.size();
+}
+
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include "types.hpp"
+#include "block_cache.hpp"
+
+// x86-64 recompiler for hot blocks
+// Compiles the longest run of supported instructions at the start of a block.
+// A, X, Y, carry and the last N/Z result live in host registers while the
+// compiled code runs. Accesses to pages with a null page table entry (I/O,
+// ROM writes, watched code pages) leave the compiled code before the
+// instruction, which then runs in the interpreter.
+struct JIT {
+
+    // Runs of a block before it gets compiled
+    constexpr static int HOT_THRESHOLD = 16;
+
+    // Size of the code buffer, flushed when full
+    constexpr static uint32 BUFFER_SIZE = 4 * 1024 * 1024;
+    constexpr static uint32 SCRATCH_SIZE = 4096;
+
+    JIT(CPU* cpu, BlockCache* cache);
+    ~JIT();
+
+    CPU* cpu;
+    Mem* mem;
+    BlockCache* cache;
+
+    // Executable memory
+    byte* buffer;
+    uint32 used;
+
+    // Single instruction code for the differential test
+    byte* scratch;
+
+#if CPU_JIT == 2
+    // Main and aux memory before the block, and after the compiled code
+    byte ram[2][Mem::MAX_SIZE];
+    byte compiledRam[2][Mem::MAX_SIZE];
+    byte bank1[2][0x1000];
+    byte compiledBank1[2][0x1000];
+#endif
+
+    // Run the compiled start of a block
+    // Returns the number of instructions executed
+    int run(Block* block);
+
+    // Number of instructions at the start of a block that can be compiled
+    int compilable(Block* block);
+
+    // Compile ops [first, last) of a block into out
+    // Returns null if the code does not fit
+    NativeCode compile(Block* block, int first, int last, byte* out, uint32 size);
+
+    // Update PC and cycles after compiled code returns
+    int finish(Block* block, int first, uint32 result);
+
+    // Drop all compiled code
+    void flush();
+
+#if CPU_JIT == 2
+    // Differential test : run each compiled instruction, then the interpreter
+    // from the same state, and report any difference
+    int verify(Block* block);
+#endif
+};
+
+#endif
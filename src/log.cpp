@@ -0,0 +1,3 @@
+#include "log.hpp"
+
+bool logEnabled = true;
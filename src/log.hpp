@@ -0,0 +1,13 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <iostream>
+
+// Emulator messages, written to std::cout while logEnabled is set
+// The batch runner clears it before starting its threads : std::cout must not
+// be used from several threads at once, even with its buffer removed.
+extern bool logEnabled;
+
+#define LOG(message) do { if(logEnabled) std::cout << message << std::endl; } while(0)
+
+#endif
@@ -0,0 +1,62 @@
+#include "machine.hpp"
+#include "embedded.hpp"
+
+Rom* Machine::loadSystemRom(std::string filename) {
+    if(filename.empty())
+        return new Rom(embeddedRom, embeddedRomSize, SYSTEM_ROM_BASE);
+
+    return new Rom(filename, SYSTEM_ROM_BASE);
+}
+
+Machine::Machine(const Rom* rom) {
+    this->rom = rom;
+
+    mem = new Mem(rom);
+    cpu = new CPU(mem);
+
+    // Video scanner timing for the floating bus
+    mem->clock = &cpu->cycleStamp;
+
+    // Disk II controller in slot 6
+    disk = new Disk();
+    insertCard(DISK_SLOT, disk);
+}
+
+Machine::~Machine() {
+    for(int slot = 1 ; slot < 8 ; slot++) {
+        if(mem->slots[slot])
+            mem->slots[slot]->detach();
+
+        delete mem->slots[slot];
+    }
+
+    delete cpu;
+    delete mem;
+}
+
+bool Machine::insertCard(int slot, Card* card) {
+
+    // disk must stay valid
+    if(slot == DISK_SLOT && mem->slots[slot])
+        return false;
+
+    // Cards run on the CPU clock and the machine events
+    card->clock = &cpu->cycleStamp;
+    card->scheduler = mem->scheduler;
+
+    if(mem->slots[slot]) {
+        mem->slots[slot]->detach();
+        delete mem->slots[slot];
+    }
+
+    mem->setCard(slot, card);
+    return true;
+}
+
+void Machine::reset() {
+    cpu->reset();
+}
+
+int Machine::loadDisk(std::string filename, bool writeBack, int drive) {
+    return disk->loadFile(filename, writeBack, drive);
+}
@@ -0,0 +1,47 @@
+#ifndef MACHINE_HPP
+#define MACHINE_HPP
+
+#include <string>
+#include "types.hpp"
+#include "rom.hpp"
+#include "disk_drive.hpp"
+#include "mem.hpp"
+#include "cpu.hpp"
+
+// One emulated Apple II
+// Owns its CPU, memory and cards, nothing is shared with other machines
+// except the read-only ROM and disk encoding tables.
+struct Machine {
+
+    // System ROM at $D000
+    constexpr static word SYSTEM_ROM_BASE = 0xd000;
+
+    // Built-in system ROM, or the given ROM file instead
+    static Rom* loadSystemRom(std::string filename);
+
+    // Slot of the boot disk controller
+    constexpr static int DISK_SLOT = 6;
+
+    const Rom* rom;
+
+    Disk* disk;     // Controller in DISK_SLOT, also in mem->slots
+    Mem* mem;
+    CPU* cpu;
+
+    Machine(const Rom* rom);
+    ~Machine();
+
+    // Power on : clear memory and jump to the reset vector
+    void reset();
+
+    // Plug a card in slot 1 - 7, replacing and deleting the previous one
+    // The boot controller in DISK_SLOT cannot be replaced : returns false
+    // and the caller keeps the card
+    bool insertCard(int slot, Card* card);
+
+    // Insert a disk in drive 0 or 1, takes effect on the next reset
+    // Without writeBack, the image file is never modified
+    int loadDisk(std::string filename, bool writeBack = true, int drive = 0);
+};
+
+#endif
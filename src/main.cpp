@@ -2,8 +2,7 @@
 #include <iomanip>
 #include <cstdlib>
 
-#include "cpu.hpp"
-#include "mem.hpp"
+#include "machine.hpp"
 #include "gui.hpp"
 #include "test.hpp"
 #include "testmem.hpp"
@@ -20,6 +19,9 @@ int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 }
 #endif
 
+// Real time spent running frames back to back in fast disk mode, per displayed frame
+static const uint32 FAST_DISK_MS = 12;
+
 int main(int argc, char *argv[]) {
 
     std::cout << "Apple 2 emulator" << std::endl;
@@ -28,24 +30,73 @@ int main(int argc, char *argv[]) {
 
     bool step = false;
 
+    // Command line : [--rom file] [--charset file.png] [--fast-disk] [--slot n image] [drive 1 image] [drive 2 image]
+    // ROM and charset are built in, the files override them
+    // --slot adds a Disk II controller in slot n (1 - 5 or 7) with the image in its drive 1
+    std::string romFile;
+    std::string charsetFile;
+    std::string diskFiles[2];
+    int disks = 0;
+    std::string slotFiles[8];
+    bool fastDisk = false;
+
+    for(int i = 1 ; i < argc ; i++) {
+        std::string arg = argv[i];
+
+        if(arg == "--rom" && i + 1 < argc)
+            romFile = argv[++i];
+        else if(arg == "--charset" && i + 1 < argc)
+            charsetFile = argv[++i];
+        else if(arg == "--fast-disk")
+            fastDisk = true;
+        else if(arg == "--slot" && i + 2 < argc) {
+            int slot = atoi(argv[++i]);
+
+            if(slot >= 1 && slot < 8 && slot != Machine::DISK_SLOT)
+                slotFiles[slot] = argv[i + 1];
+            else
+                std::cout << "[ERROR] Invalid slot " << slot << std::endl;
+
+            i++;
+        }
+        else if(disks < 2)
+            diskFiles[disks++] = arg;
+    }
+
     // Emulator components
-    Mem* mem = new Mem();
-    CPU* cpu = new CPU(mem);
-    GUI* gui = new GUI(cpu);
+    Machine* machine = new Machine(Machine::loadSystemRom(romFile));
+    CPU* cpu = machine->cpu;
+    Mem* mem = machine->mem;
+    Disk* disk = machine->disk;
+    GUI* gui = new GUI(cpu, disk);
+    gui->charsetFile = charsetFile;
+    disk->fastMode = fastDisk;
+
+    // Other disk controllers
+    for(int slot = 1 ; slot < 8 ; slot++) {
+        if(slotFiles[slot].empty())
+            continue;
+
+        Disk* controller = new Disk();
+        controller->fastMode = fastDisk;
+        controller->loadFile(slotFiles[slot]);
+        machine->insertCard(slot, controller);
+    }
 
     // CPU tests
     if(enableTests) {
         TestSuite *testsuite = new TestSuite(new CPU(new TestMem()));
         testsuite->run();
+        TestSuite::memoryTests();
     }
 
     // Init emulation
-    cpu->reset();
+    machine->reset();
     gui->init();
 
-    // Read file from command line argument
-    if(argc > 1) {
-        cpu->mem->disk->diskImage->loadFile(argv[1]);
+    // Read files from command line arguments
+    for(int i = 0 ; i < disks ; i++) {
+        machine->loadDisk(diskFiles[i], true, i);
     }
 
     std::string dummy;
@@ -81,8 +132,17 @@ int main(int argc, char *argv[]) {
         }
         else {
 
-            // Normal emulation
-            cpu->emulateCycles(17050);
+            // Normal emulation, up to the start of the next vertical blank
+            cpu->emulateUntil(mem->nextVBL);
+
+            // Fast disk : while the motor is on, run more frames within the
+            // time of one displayed frame
+            if(disk->fastMode) {
+                uint32 start = SDL_GetTicks();
+
+                while(disk->motorOn() && SDL_GetTicks() - start < FAST_DISK_MS)
+                    cpu->emulateUntil(mem->nextVBL);
+            }
             // TURBO MODE ENGAGED
             //cpu->emulateCycles(999999);
         
@@ -95,7 +155,11 @@ int main(int argc, char *argv[]) {
         
         //gui->running = false;
     }
-    
+
+    // Drives flush the sectors written since their motor last stopped
+    const Rom* rom = machine->rom;
+    delete machine;
+    delete rom;
 
     return 0;
 }
\ No newline at end of file
@@ -4,14 +4,42 @@
 #include <fcntl.h>
 
 #include "mem.hpp"
-#include "disk_drive.hpp"
+#include "log.hpp"
 
 using byte = unsigned char;
 using word = unsigned short;
 using uint32 = unsigned int;
 
-Mem::Mem() {
-    disk = new Disk();
+Mem::Mem(const Rom* systemRom) {
+    this->systemRom = systemRom;
+
+    clock = nullptr;
+    frameStart = 0;
+
+    for(int slot = 0 ; slot < 8 ; slot++)
+        slots[slot] = nullptr;
+
+    expansionSlot = 0;
+
+    scheduler = new Scheduler();
+
+    mapVersion = 0;
+
+    for(int page = 0 ; page < 0x100 ; page++) {
+        watched[page] = false;
+        watchedPages[page] = nullptr;
+        pageVersion[page] = 0;
+    }
+
+    // Page tables follow the soft switches
+    resetSwitches();
+
+    mapRoms();
+    mapPages();
+}
+
+Mem::~Mem() {
+    delete scheduler;
 }
 
 // Clear memory and load peripheral ROMs
@@ -20,17 +48,309 @@ void Mem::init() {
     // Clear RAM
     for(uint32 i = 0 ; i < MAX_SIZE ; i++) {
         data[i] = 0;
+        auxData[i] = 0;
+    }
+
+    for(uint32 i = 0 ; i < 0x1000 ; i++) {
+        lcBank1[0][i] = 0;
+        lcBank1[1][i] = 0;
+    }
+
+    // Slot ROMs as the cards show them now, no expansion ROM
+    expansionSlot = 0;
+    mapRoms();
+
+    resetSwitches();
+
+    // Memory contents changed behind the page tables
+    invalidateCode();
+
+    mapPages();
+
+    // Restart device events, a new frame starts now
+    scheduler->clear();
+    scheduleFrame(scheduler->now);
+
+    // Cards restart, their timers went with the events
+    for(int slot = 1 ; slot < 8 ; slot++) {
+        if(slots[slot])
+            slots[slot]->reset();
+    }
+}
+
+// Soft switches at power on
+void Mem::resetSwitches() {
+
+    // Slot ROMs, 40 column text page 1
+    sw_intcxrom = 0;
+    sw_slotc3rom = 0;
+    sw_80col = 0;
+    sw_altcharset = 0;
+
+    sw_text = 1;
+    sw_mixed = 0;
+    sw_page2 = 0;
+    sw_hires = 0;
+
+    sw_an0 = 0;
+    sw_an1 = 0;
+    sw_an2 = 0;
+    sw_an3 = 0;
+
+    // Main memory selected
+    sw_80store = 0;
+    sw_ramrd = 0;
+    sw_ramwrt = 0;
+    sw_altzp = 0;
+
+    // Language card : read ROM, write RAM, bank 2
+    sw_lcbank2 = 1;
+    sw_lcreadram = 0;
+    sw_lcwriteram = 1;
+    lc_prewrite = 0;
+}
+
+// Vertical blank from VBL_START to the end of the frame, then the next frame
+void Mem::scheduleFrame(uint64 start) {
+    vbl = 0;
+    frameStart = start;
+    nextVBL = start + VBL_START;
+
+    scheduler->schedule(nextVBL, [this](uint64 when) {
+        vbl = 1;
+        nextVBL = when + CYCLES_PER_FRAME;
+    });
+
+    scheduler->schedule(start + CYCLES_PER_FRAME, [this](uint64 when) {
+        scheduleFrame(when);
+    });
+}
+
+// Reads from ROM space with nothing behind it
+static const byte emptyPage[256] = {0};
+
+void Mem::mapRoms() {
+    romPages[0] = nullptr;
+
+    for(int page = 0xc1 ; page < 0x100 ; page++) {
+        const byte* read = emptyPage;
+
+        if(page < 0xc8) {
+            Card* card = slots[page - 0xc0];
+
+            if(card && card->expansionRom())
+                read = nullptr;
+            else if(card && card->slotRom())
+                read = card->slotRom();
+        }
+        else if(page < 0xd0) {
+            if(expansionSlot)
+                read = (page == 0xcf) ? nullptr : slots[expansionSlot]->expansionRom() + ((page - 0xc8) << 8);
+        }
+        else if(systemRom && systemRom->loaded && (page << 8) >= systemRom->base)
+            read = systemRom->page(page);
+
+        romPages[page - 0xc0] = read;
+    }
+}
+
+// Point every page to the memory currently backing it
+void Mem::mapPages() {
+
+    mapMainPages();
+
+    // I/O and soft switches
+    mapPage(0xc0, nullptr, nullptr);
+
+    // Peripheral card ROMs are read-only
+    for(int page = 0xc1 ; page < 0xd0 ; page++) {
+        mapPage(page, romPages[page - 0xc0], nullptr);
+    }
+
+    mapLanguageCard();
+}
+
+// Set the read and write pointers of a page
+// Watched pages keep their write pointer aside so writes reach doWrite
+void Mem::mapPage(int page, const byte* read, byte* write) {
+
+    readPages[page] = read;
+
+    if(watched[page]) {
+        watchedPages[page] = write;
+        writePages[page] = nullptr;
+    }
+    else {
+        writePages[page] = write;
+    }
+
+    mapVersion ++;
+}
+
+// Start watching a page for writes
+void Mem::watchPage(int page) {
+
+    if(watched[page])
+        return;
+
+    watched[page] = true;
+    watchedPages[page] = writePages[page];
+    writePages[page] = nullptr;
+}
+
+// Stop watching a page after a write, cached code on it is stale
+void Mem::unwatchPage(int page) {
+
+    watched[page] = false;
+    writePages[page] = watchedPages[page];
+    watchedPages[page] = nullptr;
+
+    pageVersion[page] ++;
+    mapVersion ++;
+}
+
+// Memory was modified without going through the page tables
+void Mem::invalidateCode() {
+    for(int page = 0 ; page < 0x100 ; page++) {
+        if(watched[page])
+            unwatchPage(page);
+        else
+            pageVersion[page] ++;
+    }
+}
+
+// Map $0000 - $BFFF to main or auxiliary RAM
+void Mem::mapMainPages() {
+
+    // Zero page and stack follow ALTZP
+    byte* zeroPage = sw_altzp ? auxData : data;
+
+    for(int page = 0x00 ; page < 0x02 ; page++) {
+        mapPage(page, zeroPage + (page << 8), zeroPage + (page << 8));
+    }
+
+    // Other pages follow RAMRD / RAMWRT
+    byte* readBank = sw_ramrd ? auxData : data;
+    byte* writeBank = sw_ramwrt ? auxData : data;
+
+    for(int page = 0x02 ; page < 0xc0 ; page++) {
+        mapPage(page, readBank + (page << 8), writeBank + (page << 8));
+    }
+
+    // With 80STORE on, PAGE2 selects the bank of the text page (and hi-res page 1 in HIRES mode)
+    if(sw_80store) {
+        byte* displayBank = sw_page2 ? auxData : data;
+
+        for(int page = 0x04 ; page < 0x08 ; page++) {
+            mapPage(page, displayBank + (page << 8), displayBank + (page << 8));
+        }
+
+        if(sw_hires) {
+            for(int page = 0x20 ; page < 0x40 ; page++) {
+                mapPage(page, displayBank + (page << 8), displayBank + (page << 8));
+            }
+        }
+    }
+}
+
+// PAGE2 and HIRES only change the memory map while 80STORE is on
+void Mem::mapDisplayPages() {
+    if(sw_80store)
+        mapMainPages();
+}
+
+// Map $D000 - $FFFF to ROM or language card RAM
+void Mem::mapLanguageCard() {
+
+    // ALTZP also selects the auxiliary language card
+    byte* bank = sw_altzp ? auxData : data;
+    byte* bank1 = lcBank1[sw_altzp ? 1 : 0];
+
+    for(int page = 0xd0 ; page < 0x100 ; page++) {
+
+        byte* ram = bank + (page << 8);
+
+        if(page < 0xe0 && !sw_lcbank2)
+            ram = bank1 + ((page - 0xd0) << 8);
+
+        mapPage(page, sw_lcreadram ? ram : romPages[page - 0xc0], sw_lcwriteram ? ram : nullptr);
+    }
+}
+
+// Language card soft switches ($C080 - $C08F)
+// Bit 3 selects the bank, bits 0-1 select read RAM / ROM and write enable.
+// Writing to RAM requires two consecutive reads of an odd address.
+void Mem::languageCard(uint32 addr, bool write) {
+
+    sw_lcbank2 = (addr & 0x08) ? 0 : 1;
+    sw_lcreadram = ((addr & 0x03) == 0x00 || (addr & 0x03) == 0x03) ? 1 : 0;
+
+    if(addr & 0x01) {
+        if(lc_prewrite && !write)
+            sw_lcwriteram = 1;
+    }
+    else {
+        sw_lcwriteram = 0;
+    }
+
+    lc_prewrite = ((addr & 0x01) && !write) ? 1 : 0;
+
+    mapLanguageCard();
+}
+
+void Mem::setCard(int slot, Card* card) {
+    slots[slot] = card;
+
+    if(expansionSlot == slot)
+        expansionSlot = 0;
+
+    mapRoms();
+    mapPages();
+}
+
+// Accessing $Cn00 - $CnFF maps the expansion ROM of slot n at $C800,
+// accessing $CFFF releases it
+void Mem::slotAccess(uint32 addr) {
+    if(addr == 0xcfff) {
+        selectExpansionRom(0);
+        return;
     }
 
-    // Load Apple II ROM
-    loadFile("roms/apple.rom", 0xd000, false);
+    int slot = (addr >> 8) & 0x0f;
+
+    if(slot < 8 && slot != expansionSlot && slots[slot] && slots[slot]->expansionRom())
+        selectExpansionRom(slot);
+}
+
+void Mem::selectExpansionRom(int slot) {
+    if(slot == expansionSlot)
+        return;
+
+    expansionSlot = slot;
+    mapRoms();
 
-    // Copy Disk II ROM if a disk is present
-    if(disk->diskImage->loaded) {
-        for(int i = 0 ; i < 256 ; i++)
-            data[0xc600 + i] = disk -> bootstrapROM[i];
+    for(int page = 0xc8 ; page < 0xd0 ; page++) {
+        mapPage(page, romPages[page - 0xc0], nullptr);
     }
-        
+}
+
+// Slot ROM pages read through doRead, see mapRoms
+byte Mem::slotRead(uint32 addr) {
+    byte value = 0;
+
+    if(addr < 0xc800) {
+        const byte* rom = slots[(addr >> 8) & 0x07]->slotRom();
+
+        if(rom)
+            value = rom[addr & 0xff];
+    }
+    else if(expansionSlot) {
+        value = slots[expansionSlot]->expansionRom()[addr - 0xc800];
+    }
+
+    slotAccess(addr);
+
+    return value;
 }
 
 // Read byte from memory
@@ -39,16 +359,8 @@ byte Mem::doRead(uint32 addr) {
 
     word firstByte = (addr & 0xff00);
 
-    // Zero page
-    if(firstByte == 0x0000) {
-        if(sw_altzp)
-            return auxData[addr];
-
-        return data[addr];
-    }
-
     // Soft switches
-    else if(firstByte == 0xc000) {
+    if(firstByte == 0xc000) {
         switch(addr) {
 
             case 0xc000: return keyboardKey;    // R Read keyboard data
@@ -60,19 +372,21 @@ byte Mem::doRead(uint32 addr) {
                 return strobe;
             }
 
-            case 0xc013: return sw_ramrd;
-            case 0xc014: return sw_ramwrt;
-            case 0xc015: return sw_intcxrom;
-            case 0xc016: return sw_altzp;
-            case 0xc017: return sw_slotc3rom;
-            case 0xc018: return sw_80store;
-            case 0xc019: return 0; // TODO : return VBLANK
-            case 0xc01a: return sw_text;
-            case 0xc01b: return sw_mixed;
-            case 0xc01c: return sw_page2;
-            case 0xc01d: return sw_hires;
-            case 0xc01e: return sw_altcharset;
-            case 0xc01f: return sw_80col;
+            case 0xc011: return readStatus(sw_lcbank2);
+            case 0xc012: return readStatus(sw_lcreadram);
+            case 0xc013: return readStatus(sw_ramrd);
+            case 0xc014: return readStatus(sw_ramwrt);
+            case 0xc015: return readStatus(sw_intcxrom);
+            case 0xc016: return readStatus(sw_altzp);
+            case 0xc017: return readStatus(sw_slotc3rom);
+            case 0xc018: return readStatus(sw_80store);
+            case 0xc019: return readStatus(!vbl);
+            case 0xc01a: return readStatus(sw_text);
+            case 0xc01b: return readStatus(sw_mixed);
+            case 0xc01c: return readStatus(sw_page2);
+            case 0xc01d: return readStatus(sw_hires);
+            case 0xc01e: return readStatus(sw_altcharset);
+            case 0xc01f: return readStatus(sw_80col);
             
             case 0xc020: 
                 // R Toggle cassette output port
@@ -91,10 +405,10 @@ byte Mem::doRead(uint32 addr) {
             case 0xc051: sw_text = 1;       break;
             case 0xc052: sw_mixed = 0;      break;
             case 0xc053: sw_mixed = 1;      break;
-            case 0xc054: sw_page2 = 0;      break;
-            case 0xc055: sw_page2 = 1;      break;
-            case 0xc056: sw_hires = 0;      break;
-            case 0xc057: sw_hires = 1;      break;
+            case 0xc054: sw_page2 = 0;      mapDisplayPages(); break;
+            case 0xc055: sw_page2 = 1;      mapDisplayPages(); break;
+            case 0xc056: sw_hires = 0;      mapDisplayPages(); break;
+            case 0xc057: sw_hires = 1;      mapDisplayPages(); break;
 
             case 0xc058: sw_an0 = 0;        break;
             case 0xc059: sw_an0 = 1;        break;
@@ -113,28 +427,39 @@ byte Mem::doRead(uint32 addr) {
                 // R7 push button 0
                 break;
             
-            // Disk
-            case 0xc0e0: 
-            case 0xc0e1: 
-            case 0xc0e2: 
-            case 0xc0e3: 
-            case 0xc0e4: 
-            case 0xc0e5: 
-            case 0xc0e6: 
-            case 0xc0e7: 
-            case 0xc0e8: 
-            case 0xc0e9: 
-            case 0xc0ea: 
-            case 0xc0eb: 
-            case 0xc0ec: 
-            case 0xc0ed: 
-            case 0xc0ee: 
-            case 0xc0ef: 
-                return disk->diskRead(addr);
+            // Language card
+            case 0xc080: 
+            case 0xc081: 
+            case 0xc082: 
+            case 0xc083: 
+            case 0xc084: 
+            case 0xc085: 
+            case 0xc086: 
+            case 0xc087: 
+            case 0xc088: 
+            case 0xc089: 
+            case 0xc08a: 
+            case 0xc08b: 
+            case 0xc08c: 
+            case 0xc08d: 
+            case 0xc08e: 
+            case 0xc08f: 
+                languageCard(addr, false);
                 break;
-            
-            default: return data[addr];
+
+            default:
+                // Peripheral cards, $C090 - $C0FF
+                if(addr >= 0xc090 && slots[(addr >> 4) & 7])
+                    return slots[(addr >> 4) & 7]->ioRead(addr);
+
+                return floatingBus();
         }
+
+        // Soft switches toggled by a read drive nothing on the data bus
+        return floatingBus();
+    }
+    else if(firstByte >= 0xc100 && firstByte < 0xd000) {
+        return slotRead(addr);
     }
     else {
         return data[addr];
@@ -148,21 +473,39 @@ byte Mem::doRead(uint32 addr) {
 // handles IO and soft switches
 void Mem::doWrite(uint32 addr, byte value) {
 
-    if(addr >= 0xd000)
+    byte page = addr >> 8;
+
+    // Writes to slot ROMs still select their expansion ROM
+    if(addr >= 0xc100 && addr < 0xd000)
+        slotAccess(addr);
+
+    // First write to a page holding cached code
+    // (a null pointer aside means the page is ROM and the write is dropped)
+    if(watched[page]) {
+        if(watchedPages[page]) {
+            unwatchPage(page);
+            writePages[page][addr & 0xff] = value;
+        }
+
+        return;
+    }
+
+    // ROM
+    if((addr & 0xff00) != 0xc000)
         return;
 
     switch(addr) {
 
-        case 0xc000: sw_80store = 0;    break;
-        case 0xc001: sw_80store = 1;    break;
-        case 0xc002: sw_ramrd = 0;      break;
-        case 0xc003: sw_ramrd = 1;      break;
-        case 0xc004: sw_ramwrt = 0;     break;
-        case 0xc005: sw_ramwrt = 1;     break;
+        case 0xc000: sw_80store = 0;    mapMainPages(); break;
+        case 0xc001: sw_80store = 1;    mapMainPages(); break;
+        case 0xc002: sw_ramrd = 0;      mapMainPages(); break;
+        case 0xc003: sw_ramrd = 1;      mapMainPages(); break;
+        case 0xc004: sw_ramwrt = 0;     mapMainPages(); break;
+        case 0xc005: sw_ramwrt = 1;     mapMainPages(); break;
         case 0xc006: sw_intcxrom = 0;   break;
         case 0xc007: sw_intcxrom = 1;   break;
-        case 0xc008: sw_altzp = 0;      break;
-        case 0xc009: sw_altzp = 1;      break;
+        case 0xc008: sw_altzp = 0;      mapMainPages(); mapLanguageCard(); break;
+        case 0xc009: sw_altzp = 1;      mapMainPages(); mapLanguageCard(); break;
         case 0xc00a: sw_slotc3rom = 0;  break;
         case 0xc00b: sw_slotc3rom = 1;  break;
         case 0xc00c: sw_80col = 0;      break;
@@ -174,10 +517,10 @@ void Mem::doWrite(uint32 addr, byte value) {
         case 0xc051: sw_text = 1;       break;
         case 0xc052: sw_mixed = 0;      break;
         case 0xc053: sw_mixed = 1;      break;
-        case 0xc054: sw_page2 = 0;      break;
-        case 0xc055: sw_page2 = 1;      break;
-        case 0xc056: sw_hires = 0;      break;
-        case 0xc057: sw_hires = 1;      break;
+        case 0xc054: sw_page2 = 0;      mapDisplayPages(); break;
+        case 0xc055: sw_page2 = 1;      mapDisplayPages(); break;
+        case 0xc056: sw_hires = 0;      mapDisplayPages(); break;
+        case 0xc057: sw_hires = 1;      mapDisplayPages(); break;
 
         case 0xc058: sw_an0 = 0;        break;
         case 0xc059: sw_an0 = 1;        break;
@@ -205,49 +548,54 @@ void Mem::doWrite(uint32 addr, byte value) {
         case 0xc08d: 
         case 0xc08e: 
         case 0xc08f: 
-            disk->diskWrite(addr, value);
+            languageCard(addr, true);
             break;
 
+        default:
+            // Peripheral cards, $C090 - $C0FF
+            if(addr >= 0xc090 && slots[(addr >> 4) & 7])
+                slots[(addr >> 4) & 7]->ioWrite(addr, value);
 
-        default: data[addr] = value; break;
+            break;
     }
 }
 
-// Read byte wrapper
-byte Mem::readByte(uint32 addr) {
-    if(addr < MAX_SIZE)
-        return doRead(addr);
-    
-    return 0;
-}
+// Video memory address being read at the current cycle, see "Understanding the Apple II"
+// chapter 5. Each 65-cycle line starts with H = $00, then counts $40 - $7F, the last 40
+// being displayed. The vertical count runs from $100 for the first displayed line.
+byte Mem::floatingBus() {
+    if(!clock)
+        return 0;
 
-// Read word wrapper
-word Mem::readWord(uint32 addr) {
-    if(addr < MAX_SIZE - 1)
-        return (doRead(addr + 1) << 8) | doRead(addr);
+    uint32 cycle = (*clock - frameStart) % CYCLES_PER_FRAME;
+    uint32 line = cycle / CYCLES_PER_LINE;
+    uint32 column = cycle % CYCLES_PER_LINE;
 
-    return 0;
-}
+    uint32 h = column ? 0x3f + column : 0;
+    uint32 v = (line < 256) ? 0x100 + line : line - 6;
 
-// Write byte wrapper
-void Mem::writeByte(uint32 addr, byte b) {
-    if(addr < MAX_SIZE)
-        doWrite(addr, b);
-}
+    // Text row groups of 8 lines are interleaved by 40 bytes
+    uint32 v3 = (v >> 6) & 1;
+    uint32 v4 = (v >> 7) & 1;
+    uint32 sum = (0x0d + ((h >> 3) & 7) + ((v4 << 3) | (v3 << 2) | (v4 << 1) | v3)) & 0x0f;
 
-// Write word wrapper
-void Mem::writeWord(uint32 addr, word w) {
-    if(addr < MAX_SIZE - 1) {
-        doWrite(addr, w & 0x00ff);
-        doWrite(addr + 1, (w & 0xff00) >> 8);
-    }
-}
+    uint32 addr = (h & 7) | (sum << 3) | (((v >> 3) & 7) << 7);
+
+    // Mixed mode shows text from line 160
+    bool hires = sw_hires && !sw_text && !(sw_mixed && (v & 0xa0) == 0xa0);
+    bool page2 = sw_page2 && !sw_80store;
 
-byte* Mem::getAddr(uint32 addr) {
-    if(addr >= MAX_SIZE)
-        return data;
+    if(hires)
+        addr |= ((v & 7) << 10) | (page2 ? 0x4000 : 0x2000);
+    else
+        addr |= page2 ? 0x800 : 0x400;
+
+    return data[addr];
+}
 
-    return data + addr;
+// Soft switch status in bit 7, keyboard data in bits 0-6
+byte Mem::readStatus(byte sw) {
+    return (sw ? 0x80 : 0x00) | (keyboardKey & 0x7f);
 }
 
 // Clear keyboard strobe
@@ -260,36 +608,41 @@ void Mem::strobeKeyboardKey(byte ascii) {
     keyboardKey = ascii | 0x80; // Set keyboard strobe to 1
 }
 
-// Load binary file into memory
-int Mem::loadFile(std::string filename, word addr, bool aux) {
-
-    char buffer[MAX_SIZE];
+// Read a binary file into a buffer
+// Returns the number of bytes read, or -1 if the file cannot be opened
+static int readFile(std::string filename, char* buffer, uint32 maxSize) {
 
     std::ifstream in;
 
     in.open(filename, std::ios::in | std::ios::binary);
 
-    if(!in.is_open()) {
-        std::cout << "Could not read ROM file " << filename << std::endl;
-        return 1;
-    }
+    if(!in.is_open())
+        return -1;
 
-    in.read(buffer, MAX_SIZE);
+    in.read(buffer, maxSize);
 
-    uint32 size = in.gcount();
+    return in.gcount();
+}
 
-    std::cout << "ROM size is " << std::dec << size << " bytes" << std::endl;
+// Load binary file into memory
+int Mem::loadFile(std::string filename, word addr, bool aux) {
 
-    if(aux) {
-        for(uint32 i = 0; i < size && i + addr < MAX_SIZE; i++) {
-            auxData[addr + i] = buffer[i];
-        }
+    char buffer[MAX_SIZE];
+
+    int size = readFile(filename, buffer, MAX_SIZE);
+
+    if(size < 0) {
+        LOG("Could not read file " << filename);
+        return 1;
     }
-    else {
-        for(uint32 i = 0; i < size && i + addr < MAX_SIZE; i++) {
-            data[addr + i] = buffer[i];
-        }
+
+    byte* dest = aux ? auxData : data;
+
+    for(uint32 i = 0; i < (uint32)size && i + addr < MAX_SIZE; i++) {
+        dest[addr + i] = buffer[i];
     }
 
+    invalidateCode();
+
     return 0;
-}
\ No newline at end of file
+}
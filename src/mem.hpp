@@ -3,21 +3,77 @@
 
 #include <fstream>
 #include "types.hpp"
-#include "disk_drive.hpp"
+#include "card.hpp"
+#include "rom.hpp"
+#include "scheduler.hpp"
 
 struct Mem {
 
     // Max RAM size
     constexpr static uint32 MAX_SIZE = 64 * 1024;
 
-    // Disk drive
-    Disk *disk;
+    // Peripheral cards by slot, owned by the machine
+    // Slot 0 is the built-in language card, always null here
+    Card* slots[8];
+
+    // Slot whose expansion ROM is mapped at $C800, 0 for none
+    int expansionSlot;
+
+    // Shared system ROM, mapped directly by the page tables
+    const Rom *systemRom;
+
+    // Device events
+    Scheduler *scheduler;
+
+    // Video timing
+    // 65 cycles per line, 262 lines per frame, vertical blank from line 192
+    constexpr static uint32 CYCLES_PER_LINE = 65;
+    constexpr static uint32 CYCLES_PER_FRAME = CYCLES_PER_LINE * 262;
+    constexpr static uint32 VBL_START = CYCLES_PER_LINE * 192;
+
+    byte vbl;           // In vertical blank, $C019 reads 0 in bit 7
+    uint64 nextVBL;     // Start of the next vertical blank
+    uint64 frameStart;  // Start of the current frame
+
+    // CPU cycle counter, set by the machine
+    const uint64* clock;
+
+    // Start of the ROM area
+    constexpr static uint32 ROM_BASE = 0xc000;
 
     // RAM
+    // $0000 - $BFFF : main RAM
+    // $C000 - $CFFF : unused, the I/O page and slot ROMs are not backed by RAM
+    // $D000 - $FFFF : language card bank 2 and common RAM
     byte data[MAX_SIZE];
 
     // Auxiliary / bankswitched memory
     byte auxData[MAX_SIZE];
+
+    // Language card bank 1 ($D000 - $DFFF), main and auxiliary
+    byte lcBank1[2][0x1000];
+
+    // Read pointers of the ROM pages from $C000
+    // $C100 - $C7FF : slot ROMs, null for slots with an expansion ROM so accesses select it
+    // $C800 - $CFFF : selected expansion ROM, $CFFF read through doRead to release it
+    // $D000 - $FFFF : system ROM, or an empty page below its base
+    const byte* romPages[0x40];
+
+    // Page tables
+    // One entry per 256-byte page, pointing to the memory backing that page.
+    // A null entry sends the access through doRead / doWrite (I/O page, ROM writes).
+    const byte* readPages[256];
+    byte* writePages[256];
+
+    // Incremented whenever a page table entry changes
+    uint32 mapVersion;
+
+    // Pages holding cached code
+    // Their write pointer is kept aside and the write page table entry is null,
+    // so the first write goes through doWrite and bumps the page version.
+    bool watched[256];
+    byte* watchedPages[256];
+    uint32 pageVersion[256];
     
     // Soft switches
     //                      OFF  /   ON
@@ -40,19 +96,61 @@ struct Mem {
     byte sw_an2;        // $C05C / $C05D RW
     byte sw_an3;        // $C05E / $C05F RW
 
+    // Language card       $C080 - $C08F RW
+    byte sw_lcbank2;    // Bank 2 / bank 1 at $D000
+    byte sw_lcreadram;  // Read RAM / ROM
+    byte sw_lcwriteram; // Write RAM enabled
+    byte lc_prewrite;   // First of the two reads needed to write-enable
+
     // Keyboard data
     byte keyboardKey = 0;
 
+    // Soft switch status for $C011 - $C01F reads
+    byte readStatus(byte sw);
+
+    // Byte the video scanner is reading, seen on reads of unused I/O addresses
+    byte floatingBus();
+
     // Clear keyboard strobe
     void strobeKeyboardKey(byte ascii);
     void clearKeyboardStrobe();
 
     // Consutrctor
-    Mem();
+    Mem(const Rom* systemRom);
+    ~Mem();
 
     // Clear RAM
     void init();
 
+    // Soft switches at power on
+    void resetSwitches();
+
+    // Schedule the vertical blank events of the frame starting at start
+    void scheduleFrame(uint64 start);
+
+    // Rebuild page tables from the current soft switch state
+    void mapPage(int page, const byte* read, byte* write);
+    void mapPages();
+    void mapMainPages();
+    void mapDisplayPages();
+    void mapLanguageCard();
+
+    // Write watch for cached code
+    void watchPage(int page);
+    void unwatchPage(int page);
+    void invalidateCode();
+
+    // Language card soft switches
+    void languageCard(uint32 addr, bool write);
+
+    // Plug a card in slot 1 - 7, or remove it with null
+    void setCard(int slot, Card* card);
+
+    // Slot ROM accesses : select or release the expansion ROM
+    void slotAccess(uint32 addr);
+    void selectExpansionRom(int slot);
+    byte slotRead(uint32 addr);
+
     // Internal read/write with soft switches
     byte doRead(uint32 addr);
     void doWrite(uint32 addr, byte value);
@@ -65,11 +163,41 @@ struct Mem {
     void writeByte(uint32 addr, byte b);
     void writeWord(uint32 addr, word w);
 
-    // Returns pointer to RAM location
-    byte* getAddr(uint32 addr);
-
-    // Load ROM file in memory
+    // Load binary file in RAM
     int loadFile(std::string filename, word addr, bool aux);
+
+    // Point romPages to the slot and system ROMs
+    void mapRoms();
 };
 
+// Read and write go through the page tables first, only the I/O page
+// falls back to doRead / doWrite. Defined here so CPU fetches are inlined.
+
+inline byte Mem::readByte(uint32 addr) {
+    const byte* page = readPages[(addr >> 8) & 0xff];
+
+    if(page)
+        return page[addr & 0xff];
+
+    return doRead(addr & 0xffff);
+}
+
+inline word Mem::readWord(uint32 addr) {
+    return (readByte(addr + 1) << 8) | readByte(addr);
+}
+
+inline void Mem::writeByte(uint32 addr, byte b) {
+    byte* page = writePages[(addr >> 8) & 0xff];
+
+    if(page)
+        page[addr & 0xff] = b;
+    else
+        doWrite(addr & 0xffff, b);
+}
+
+inline void Mem::writeWord(uint32 addr, word w) {
+    writeByte(addr, w & 0x00ff);
+    writeByte(addr + 1, (w & 0xff00) >> 8);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include <cstring>
+#include "nibble_cache.hpp"
+
+// FNV-1a over the sector data, track number and sector order
+static uint64 trackKey(const byte* sectors, int track, bool dosOrder) {
+    uint64 h = 14695981039346656037ull;
+
+    for(int i = 0 ; i < 16 * 256 ; i++) {
+        h ^= sectors[i];
+        h *= 1099511628211ull;
+    }
+
+    h ^= track;
+    h *= 1099511628211ull;
+
+    h ^= dosOrder;
+    h *= 1099511628211ull;
+
+    return h;
+}
+
+NibbleCache::NibbleCache() {
+    inserted = 0;
+}
+
+NibbleCache& NibbleCache::shared() {
+    static NibbleCache cache;
+    return cache;
+}
+
+SharedTrack NibbleCache::get(const byte* sectors, int track, bool dosOrder) {
+    uint64 key = trackKey(sectors, track, dosOrder);
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto range = tracks.equal_range(key);
+
+    for(auto it = range.first ; it != range.second ; ++it) {
+        SharedTrack found = it->second.lock();
+
+        if(found && found->track == track && found->dosOrder == dosOrder && memcmp(found->sectors, sectors, sizeof(found->sectors)) == 0)
+            return found;
+    }
+
+    NibbleTrack* encoded = new NibbleTrack();
+    encoded->track = track;
+    encoded->dosOrder = dosOrder;
+    memcpy(encoded->sectors, sectors, sizeof(encoded->sectors));
+    encodeNibbles(sectors, encoded->nibbles, dosOrder, track);
+
+    SharedTrack result(encoded);
+    tracks.emplace(key, result);
+
+    if(++inserted >= SWEEP_INTERVAL)
+        sweep();
+
+    return result;
+}
+
+// Drop entries of tracks no drive uses anymore
+void NibbleCache::sweep() {
+    for(auto it = tracks.begin() ; it != tracks.end() ; ) {
+        if(it->second.expired())
+            it = tracks.erase(it);
+        else
+            ++it;
+    }
+
+    inserted = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef NIBBLE_CACHE_HPP
+#define NIBBLE_CACHE_HPP
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "types.hpp"
+#include "disk_images.hpp"
+
+// Encoded track, shared read-only between drives
+struct NibbleTrack {
+    int track;
+    bool dosOrder;
+    byte sectors[16 * 256];         // Source data, to tell hash collisions apart
+    byte nibbles[NIBBLES_PER_TRACK];
+};
+
+typedef std::shared_ptr<const NibbleTrack> SharedTrack;
+
+// Process-wide cache of encoded tracks, keyed by a hash of their sector data
+// Drives booting the same image share one copy of each track. A track is
+// released when the last drive using it lets go.
+struct NibbleCache {
+
+    // Encoded tracks since the last sweep before expired entries are dropped
+    constexpr static int SWEEP_INTERVAL = 256;
+
+    std::mutex lock;
+    std::unordered_multimap<uint64, std::weak_ptr<const NibbleTrack>> tracks;
+    int inserted;
+
+    NibbleCache();
+
+    static NibbleCache& shared();
+
+    // Encoded track for the given sectors, encoding it if no drive holds it
+    SharedTrack get(const byte* sectors, int track, bool dosOrder);
+
+    void sweep();
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include "rom.hpp"
+#include "log.hpp"
+
+#ifndef _WIN64
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+Rom::Rom(std::string filename, word base) {
+    this->base = base;
+
+    // Anything past $FFFF is ignored
+    size = 0x10000 - base;
+
+    data = nullptr;
+    buffer = nullptr;
+    loaded = false;
+    mapped = false;
+
+#ifndef _WIN64
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+
+    if(fd != -1 && fstat(fd, &info) == 0 && (uint32)info.st_size == size) {
+        void* memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if(memory != MAP_FAILED) {
+            data = (const byte*)memory;
+            mapped = true;
+        }
+    }
+
+    if(fd != -1)
+        close(fd);
+#endif
+
+    if(!mapped) {
+        std::ifstream in;
+
+        in.open(filename, std::ios::in | std::ios::binary);
+
+        if(!in.is_open()) {
+            LOG("Could not read ROM file " << filename);
+            return;
+        }
+
+        buffer = new byte[size];
+        memset(buffer, 0, size);
+
+        in.read((char*)buffer, size);
+        data = buffer;
+    }
+
+    loaded = true;
+
+    LOG("ROM size is " << std::dec << size << " bytes");
+}
+
+Rom::Rom(const byte* image, uint32 imageSize, word base) {
+    this->base = base;
+
+    size = 0x10000 - base;
+
+    data = image;
+    buffer = nullptr;
+    loaded = true;
+    mapped = false;
+
+    if(imageSize != size) {
+        buffer = new byte[size];
+        memset(buffer, 0, size);
+        memcpy(buffer, image, imageSize < size ? imageSize : size);
+        data = buffer;
+    }
+}
+
+Rom::~Rom() {
+#ifndef _WIN64
+    if(mapped)
+        munmap((void*)data, size);
+#endif
+
+    delete[] buffer;
+}
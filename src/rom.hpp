@@ -0,0 +1,37 @@
+#ifndef ROM_HPP
+#define ROM_HPP
+
+#include <string>
+#include "types.hpp"
+
+// ROM image, loaded once and shared read-only between machines
+// Built-in images are used in place. A file is memory-mapped when it covers
+// whole pages up to $FFFF, otherwise it is copied to a zero-padded buffer.
+struct Rom {
+
+    // Contents from base to $FFFF
+    const byte* data;
+    uint32 size;
+
+    // Address of the first byte
+    word base;
+
+    bool loaded;
+    bool mapped;
+
+    // Zero-padded copy, owned
+    byte* buffer;
+
+    Rom(std::string filename, word base);
+    Rom(const byte* image, uint32 imageSize, word base);
+    ~Rom();
+
+    // Read pointer for a page at or above base
+    const byte* page(int page) const;
+};
+
+inline const byte* Rom::page(int page) const {
+    return data + (page << 8) - base;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include "scheduler.hpp"
+
+// std heaps are max-heaps : order on the latest event first
+static bool later(const Scheduler::Event& a, const Scheduler::Event& b) {
+    if(a.when != b.when)
+        return a.when > b.when;
+
+    return a.id > b.id;
+}
+
+Scheduler::Scheduler() {
+    now = 0;
+    lastId = 0;
+
+    clear();
+}
+
+uint32 Scheduler::schedule(uint64 when, Handler handler) {
+    lastId++;
+
+    events.push_back({when, lastId, handler});
+    std::push_heap(events.begin(), events.end(), later);
+
+    next = events.front().when;
+
+    return lastId;
+}
+
+void Scheduler::cancel(uint32 id) {
+    for(uint32 i = 0 ; i < events.size() ; i++) {
+        if(events[i].id == id) {
+            events.erase(events.begin() + i);
+            std::make_heap(events.begin(), events.end(), later);
+            break;
+        }
+    }
+
+    next = events.empty() ? NEVER : events.front().when;
+}
+
+void Scheduler::clear() {
+    events.clear();
+    next = NEVER;
+}
+
+void Scheduler::run(uint64 now) {
+    this->now = now;
+
+    while(!events.empty() && events.front().when <= now) {
+
+        std::pop_heap(events.begin(), events.end(), later);
+        Event event = std::move(events.back());
+        events.pop_back();
+
+        next = events.empty() ? NEVER : events.front().when;
+
+        // The handler may schedule or cancel events
+        event.handler(event.when);
+    }
+
+    next = events.empty() ? NEVER : events.front().when;
+}
@@ -0,0 +1,52 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <vector>
+#include <functional>
+#include "types.hpp"
+
+// Device events keyed on the CPU cycle counter
+// CPU::emulateCycles runs instructions up to the next event, then runs every
+// event that is due. Periodic events schedule themselves again from their handler.
+struct Scheduler {
+
+    // Called with the time the event was scheduled for
+    typedef std::function<void(uint64 when)> Handler;
+
+    struct Event {
+        uint64 when;
+        uint32 id;          // Also keeps events due at the same cycle in order
+        Handler handler;
+    };
+
+    // No pending event
+    constexpr static uint64 NEVER = ~(uint64)0;
+
+    // Pending events, min-heap on time
+    std::vector<Event> events;
+
+    // Time of the earliest pending event
+    uint64 next;
+
+    // Time of the last run, base for events scheduled outside of a handler
+    uint64 now;
+
+    uint32 lastId;
+
+    // Constructor
+    Scheduler();
+
+    // Add an event, returns its id
+    uint32 schedule(uint64 when, Handler handler);
+
+    // Remove a pending event
+    void cancel(uint32 id);
+
+    // Remove all pending events
+    void clear();
+
+    // Run events due at or before now
+    void run(uint64 now);
+};
+
+#endif
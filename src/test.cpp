@@ -42,4 +42,56 @@ int TestSuite::run() {
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+// Language card bank 1 must not share storage with the I/O page
+static int languageCardBank1(Mem* mem) {
+
+    // Bank 1, read and write RAM
+    mem->readByte(0xc08b);
+    mem->readByte(0xc08b);
+
+    mem->writeByte(0xd010, 0x5a);
+    mem->writeByte(0xd030, 0xa5);
+
+    // Keyboard strobe and speaker
+    mem->writeByte(0xc010, 0x00);
+    mem->writeByte(0xc030, 0x00);
+    mem->readByte(0xc010);
+
+    // Bank 2 at the same addresses
+    mem->readByte(0xc083);
+    mem->readByte(0xc083);
+    mem->writeByte(0xd010, 0x11);
+
+    mem->readByte(0xc08b);
+
+    if(mem->readByte(0xd010) != 0x5a || mem->readByte(0xd030) != 0xa5) {
+        std::cout << "Language card bank 1 overwritten" << std::endl;
+        return 1;
+    }
+
+    mem->readByte(0xc083);
+
+    if(mem->readByte(0xd010) != 0x11) {
+        std::cout << "Language card bank 2 overwritten" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int TestSuite::memoryTests() {
+
+    Mem* mem = new Mem(nullptr);
+    mem->init();
+
+    int failed = languageCardBank1(mem);
+
+    delete mem;
+
+    if(!failed)
+        std::cout << "Memory tests OK" << std::endl;
+
+    return failed;
+}
@@ -13,6 +13,9 @@ struct TestSuite {
 
     int run();
 
+    // Soft switch and memory map checks, no ROM needed
+    static int memoryTests();
+
 };
 
 
@@ -7,6 +7,12 @@ using byte = unsigned char;
 using word = unsigned short;
 using uint32 = unsigned int;
 
+// Flat 64K RAM : every page is readable and writable, no I/O page
+TestMem::TestMem() : Mem(nullptr) {
+    for(int page = 0 ; page < 0x100 ; page++)
+        mapPage(page, data + (page << 8), data + (page << 8));
+}
+
 void TestMem::clear() {
     for(uint32 i = 0 ; i < MAX_SIZE ; i++) {
         data[i] = 0;
@@ -43,13 +49,6 @@ void TestMem::writeWord(uint32 addr, word w) {
     }
 }
 
-byte* TestMem::getAddr(uint32 addr) {
-    if(addr >= MAX_SIZE)
-        return data;
-
-    return data + addr;
-}
-
 
 // Load binary file into memory
 int TestMem::loadFile(std::string filename, word addr, bool aux) {
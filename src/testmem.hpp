@@ -17,6 +17,8 @@ struct TestMem : public Mem {
 
     byte data[MAX_SIZE];
 
+    TestMem();
+
     void clear();
 
     byte readByte(uint32 addr);
@@ -25,8 +27,6 @@ struct TestMem : public Mem {
     void writeByte(uint32 addr, byte b);
     void writeWord(uint32 addr, word w);
 
-    byte* getAddr(uint32 addr);
-
     int loadFile(std::string filename, word addr, bool aux);
 };
 
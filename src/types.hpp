@@ -12,5 +12,6 @@ typedef uint8_t byte;
 typedef int8_t signed_byte;
 typedef uint16_t word;
 typedef uint32_t uint32;
+typedef uint64_t uint64;
 
 #endif
\ No newline at end of file
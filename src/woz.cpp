@@ -0,0 +1,130 @@
+#include <iostream>
+#include <cstring>
+#include "woz.hpp"
+#include "log.hpp"
+
+static const uint32 HEADER_SIZE = 12;
+
+// WOZ1 tracks are fixed 6656-byte records
+static const uint32 WOZ1_TRACK_SIZE = 6656;
+static const uint32 WOZ1_BITS_SIZE = 6646;
+
+// WOZ2 track data is stored in 512-byte blocks
+static const uint32 WOZ2_BLOCK_SIZE = 512;
+
+static uint32 read16(const byte* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32 read32(const byte* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+WozImage::WozImage() {
+    version = 0;
+    writeProtected = true;
+    bitTiming = 32;
+
+    memset(trackMap, NO_TRACK, sizeof(trackMap));
+
+    for(int i = 0 ; i < QUARTER_TRACKS ; i++)
+        tracks[i] = {nullptr, 0};
+}
+
+bool WozImage::isWoz(const byte* file, uint32 size) {
+    return size >= HEADER_SIZE &&
+           (memcmp(file, "WOZ1", 4) == 0 || memcmp(file, "WOZ2", 4) == 0) &&
+           memcmp(file + 4, "\xff\x0a\x0d\x0a", 4) == 0;
+}
+
+bool WozImage::parse(const byte* file, uint32 size) {
+
+    if(!isWoz(file, size))
+        return false;
+
+    version = file[3] - '0';
+
+    const byte* info = nullptr;
+    const byte* tmap = nullptr;
+    const byte* trks = nullptr;
+    uint32 trksSize = 0;
+
+    // Chunks : 4-byte id, 4-byte size, data
+    for(uint32 pos = HEADER_SIZE ; pos + 8 <= size ; ) {
+        const byte* chunk = file + pos;
+        uint32 chunkSize = read32(chunk + 4);
+
+        if(chunkSize > size - pos - 8) {
+            LOG("[ERROR] Truncated WOZ chunk");
+            return false;
+        }
+
+        if(memcmp(chunk, "INFO", 4) == 0 && chunkSize >= 60)
+            info = chunk + 8;
+        else if(memcmp(chunk, "TMAP", 4) == 0 && chunkSize >= QUARTER_TRACKS)
+            tmap = chunk + 8;
+        else if(memcmp(chunk, "TRKS", 4) == 0) {
+            trks = chunk + 8;
+            trksSize = chunkSize;
+        }
+
+        pos += 8 + chunkSize;
+    }
+
+    if(!info || !tmap || !trks) {
+        LOG("[ERROR] WOZ file without INFO, TMAP or TRKS chunk");
+        return false;
+    }
+
+    if(info[1] != 1) {
+        LOG("[ERROR] WOZ image is not a 5.25\" disk");
+        return false;
+    }
+
+    writeProtected = info[2] != 0;
+
+    if(version >= 2 && info[39] != 0)
+        bitTiming = info[39];
+
+    memcpy(trackMap, tmap, QUARTER_TRACKS);
+
+    for(int i = 0 ; i < QUARTER_TRACKS ; i++) {
+
+        if(version == 1) {
+            if((i + 1) * WOZ1_TRACK_SIZE > trksSize)
+                break;
+
+            const byte* record = trks + i * WOZ1_TRACK_SIZE;
+            uint32 bitCount = read16(record + 6648);
+
+            if(bitCount <= WOZ1_BITS_SIZE * 8)
+                tracks[i] = {record, bitCount};
+        }
+        else {
+            if((uint32)(i + 1) * 8 > trksSize)
+                break;
+
+            const byte* entry = trks + i * 8;
+            uint32 start = read16(entry) * WOZ2_BLOCK_SIZE;
+            uint32 blocks = read16(entry + 2);
+            uint32 bitCount = read32(entry + 4);
+
+            if(start && start <= size && blocks * WOZ2_BLOCK_SIZE <= size - start && (bitCount + 7) / 8 <= blocks * WOZ2_BLOCK_SIZE)
+                tracks[i] = {file + start, bitCount};
+        }
+    }
+
+    // Map entries pointing to missing tracks read as empty
+    for(int i = 0 ; i < QUARTER_TRACKS ; i++)
+        if(trackMap[i] != NO_TRACK && (trackMap[i] >= QUARTER_TRACKS || tracks[trackMap[i]].bitCount == 0))
+            trackMap[i] = NO_TRACK;
+
+    return true;
+}
+
+const WozImage::Track* WozImage::track(int quarterTrack) const {
+    if(quarterTrack < 0 || quarterTrack >= QUARTER_TRACKS || trackMap[quarterTrack] == NO_TRACK)
+        return nullptr;
+
+    return &tracks[trackMap[quarterTrack]];
+}
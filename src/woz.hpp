@@ -0,0 +1,45 @@
+#ifndef WOZ_HPP
+#define WOZ_HPP
+
+#include "types.hpp"
+
+// WOZ 1.0 / 2.0 bitstream images
+// Tracks are raw bit streams of any length, read in place from the mapped file.
+// Non-standard sync patterns and track lengths used by copy protections survive as is.
+struct WozImage {
+
+    constexpr static int QUARTER_TRACKS = 160;
+
+    // No track at this quarter-track position
+    constexpr static byte NO_TRACK = 0xff;
+
+    struct Track {
+        const byte* bits;       // Most significant bit first
+        uint32 bitCount;
+    };
+
+    int version;
+    bool writeProtected;
+
+    // Duration of a bit in 1/8 microseconds, 32 for standard disks
+    byte bitTiming;
+
+    // Quarter track to track index
+    byte trackMap[QUARTER_TRACKS];
+
+    Track tracks[QUARTER_TRACKS];
+
+    WozImage();
+
+    // True for a WOZ file header
+    static bool isWoz(const byte* file, uint32 size);
+
+    // Parse a WOZ file, keeping pointers into it
+    // Returns false if the file is damaged or not a 5.25" disk
+    bool parse(const byte* file, uint32 size);
+
+    // Track under the head at a quarter-track position, nullptr for an empty track
+    const Track* track(int quarterTrack) const;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""
+Embed the system ROM and the character set into the emulator binary.
+The charset PNG is decoded here, at build time, into a 1 bit per pixel bitmap.
+
+usage : embed_data.py <rom> <charset png> <output.cpp>
+"""
+
+import struct
+import sys
+import zlib
+
+
+def read_png(filename):
+    """Decode an 8-bit RGB or RGBA PNG, returns (width, height, rows of (r, g, b) tuples)"""
+
+    with open(filename, "rb") as f:
+        data = f.read()
+
+    if data[:8] != b"\x89PNG\r\n\x1a\n":
+        sys.exit(filename + " is not a PNG file")
+
+    pos = 8
+    idat = b""
+
+    while pos < len(data):
+        length, kind = struct.unpack(">I4s", data[pos:pos + 8])
+        chunk = data[pos + 8:pos + 8 + length]
+
+        if kind == b"IHDR":
+            width, height, depth, color, _, _, interlace = struct.unpack(">IIBBBBB", chunk)
+
+            if depth != 8 or color not in (2, 6) or interlace:
+                sys.exit(filename + " : only 8-bit non-interlaced RGB / RGBA is supported")
+
+            bpp = 4 if color == 6 else 3
+
+        elif kind == b"IDAT":
+            idat += chunk
+
+        pos += 12 + length
+
+    raw = zlib.decompress(idat)
+    stride = width * bpp
+    rows = []
+    previous = bytearray(stride)
+
+    for y in range(height):
+        start = y * (stride + 1)
+        method = raw[start]
+        line = bytearray(raw[start + 1:start + 1 + stride])
+
+        for x in range(stride):
+            a = line[x - bpp] if x >= bpp else 0
+            b = previous[x]
+            c = previous[x - bpp] if x >= bpp else 0
+
+            if method == 1:
+                line[x] = (line[x] + a) & 0xff
+            elif method == 2:
+                line[x] = (line[x] + b) & 0xff
+            elif method == 3:
+                line[x] = (line[x] + (a + b) // 2) & 0xff
+            elif method == 4:
+                pa, pb, pc = abs(b - c), abs(a - c), abs(a + b - 2 * c)
+                predictor = a if pa <= pb and pa <= pc else (b if pb <= pc else c)
+                line[x] = (line[x] + predictor) & 0xff
+
+        rows.append([tuple(line[x:x + 3]) for x in range(0, stride, bpp)])
+        previous = line
+
+    return width, height, rows
+
+
+def array(name, data):
+    lines = []
+
+    for i in range(0, len(data), 16):
+        lines.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+
+    return "extern const byte %s[%d] = {\n%s\n};\n" % (name, len(data), "\n".join(lines))
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(__doc__.strip())
+
+    rom_file, charset_file, output = sys.argv[1:]
+
+    with open(rom_file, "rb") as f:
+        rom = f.read()
+
+    width, height, rows = read_png(charset_file)
+
+    if (width, height) != (128, 128):
+        sys.exit(charset_file + " : expected a 128x128 character set")
+
+    # Lit pixels set, leftmost pixel in bit 7
+    charset = bytearray()
+
+    for row in rows:
+        for x in range(0, width, 8):
+            bits = 0
+
+            for pixel in row[x:x + 8]:
+                bits = (bits << 1) | (1 if sum(pixel) > 3 * 0x80 else 0)
+
+            charset.append(bits)
+
+    with open(output, "w") as f:
+        f.write("// Generated by tools/embed_data.py from %s and %s, do not edit\n\n" % (rom_file, charset_file))
+        f.write('#include "embedded.hpp"\n\n')
+        f.write("extern const uint32 embeddedRomSize = %d;\n\n" % len(rom))
+        f.write(array("embeddedRom", rom))
+        f.write("\n")
+        f.write(array("embeddedCharset", charset))
+
+
+if __name__ == "__main__":
+    main()